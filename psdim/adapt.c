@@ -0,0 +1,320 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* coarse-to-fine rendering. Most of a rendered page is either blank
+   or inside the printed area, and cannot affect its bounding box.
+   Here the document is first rendered at a low resolution, to find
+   the approximate bounding box of each page set. Then only narrow
+   strips around the candidate edges are rendered at full resolution,
+   to find the exact edges. Each strip is rendered as a page of its
+   own, so ghostscript produces far less output than for the whole
+   canvas. If a strip turns out to be too narrow, or the coarse pass
+   finds pages placed relative to the top of the media, the whole
+   canvas is rendered after all. Only exact bounding boxes (without
+   percentiles) are computed this way. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "jobs.h"
+#include "bbox.h"
+#include "adapt.h"
+
+#define SCALE  4      /* a coarse pixel is SCALE x SCALE points */
+#define MARGIN SCALE  /* allowance for rounding at low resolution, in points */
+
+/* sides of a window */
+#define LEFT   0x1
+#define RIGHT  0x2
+#define BOTTOM 0x4
+#define TOP    0x8
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+/* set win to the rectangle x0,y0,x1,y1 (in points), clipped to the
+   canvas */
+static void window_set(window_t *win, int x0, int y0, int x1, int y1, int res) {
+  win->x = max(x0, 0);
+  win->y = max(y0, 0);
+  win->w = min(x1, info.canvas_w) - win->x;
+  win->h = min(y1, info.canvas_h) - win->y;
+  win->res = res;
+  win->pagesize = 0;
+}
+
+/* render the window win of doc, and find the extent of the ink of
+   each of n page sets, in points on the canvas. Empty page sets get
+   x0 >= x1. Below 72 dpi, the window is rendered anti-aliased (see
+   gs_window), and a pixel that is covered at all counts as ink. If
+   anchor is not NULL, set *anchor as hist_page leaves hist->anchor,
+   and *moved to the number of pages that were moved down by their
+   page size. Return the number of pages rendered, or -1 with merrno
+   set. */
+static int render_extents(doc_t *doc, window_t *win, int n, bbox_t *ext,
+			  int *anchor, int *moved) {
+  hist_t *hist;
+  long long *rowcount, *colcount;
+  int i, j, r, w, h, scale;
+
+  w = win->w * win->res / 72;
+  h = win->h * win->res / 72;
+  scale = 72 / win->res;
+  hist = hist_new(n, w, h);
+  if (!hist) {
+    return -1;
+  }
+  hist->exact = 1;
+  hist->res = win->res;
+  hist->gray = win->res < 72;
+  r = render_range(doc, 0, -1, 0, win, hist);
+  if (r < 0) {
+    hist_free(hist);
+    return -1;
+  }
+  if (anchor) {
+    *anchor = hist->anchor;
+    *moved = hist->moved;
+  }
+
+  for (j=0; j<n; j++) {
+    rowcount = hist->rowcount + (size_t)j*h;
+    colcount = hist->colcount + (size_t)j*w;
+    ext[j].x0 = win->x + win->w;
+    ext[j].y0 = win->y + win->h;
+    ext[j].x1 = 0;
+    ext[j].y1 = 0;
+    for (i=0; i<w; i++) {
+      if (colcount[i]) {
+	ext[j].x0 = min(ext[j].x0, win->x + i*scale);
+	ext[j].x1 = win->x + (i+1)*scale;
+      }
+    }
+    for (i=0; i<h; i++) {
+      if (rowcount[i]) {
+	ext[j].y0 = min(ext[j].y0, win->y + i*scale);
+	ext[j].y1 = win->y + (i+1)*scale;
+      }
+    }
+  }
+  hist_free(hist);
+  return r;
+}
+
+/* render the rectangle x0,y0,x1,y1 of doc at full resolution, and
+   find the extents of the page sets that are not empty in coarse.
+   The ink must stay clear of the sides of the rectangle given in
+   mask, except where these are edges of the canvas; otherwise the
+   true edge might lie outside. Return 1 on success, 0 if the result
+   is inconclusive, or -1 with merrno set. */
+static int fine(doc_t *doc, int n, int pages, bbox_t *coarse,
+		int x0, int y0, int x1, int y1, int mask, bbox_t *ext) {
+  window_t win;
+  int j, r;
+
+  window_set(&win, x0, y0, x1, y1, 72);
+  if (win.w <= 0 || win.h <= 0) {
+    return 0;
+  }
+  r = render_extents(doc, &win, n, ext, NULL, NULL);
+  if (r < 0) {
+    return -1;
+  }
+  if (r != pages) {
+    return 0;
+  }
+  for (j=0; j<n; j++) {
+    if (coarse[j].x0 >= coarse[j].x1) {
+      continue;
+    }
+    if (ext[j].x0 >= ext[j].x1) {
+      return 0;
+    }
+    if (((mask & LEFT) && ext[j].x0 == win.x && win.x > 0)
+	|| ((mask & RIGHT) && ext[j].x1 == win.x+win.w && win.x+win.w < info.canvas_w)
+	|| ((mask & BOTTOM) && ext[j].y0 == win.y && win.y > 0)
+	|| ((mask & TOP) && ext[j].y1 == win.y+win.h && win.y+win.h < info.canvas_h)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* find the exact bounding boxes of bboxes from the coarse ones, by
+   rendering strips around their edges. Return 1 on success, 0 if the
+   result is inconclusive, or -1 with merrno set. */
+static int refine(doc_t *doc, int n, int pages, bbox_t *coarse, bbox_t *bboxes) {
+  bbox_t *ext0, *ext1;
+  int j, r;
+  int lo0, hi0, lo1, hi1, a, b;
+
+  ext0 = (bbox_t *)malloc(n * sizeof(bbox_t));
+  ext1 = (bbox_t *)malloc(n * sizeof(bbox_t));
+  if (!ext0 || !ext1) {
+    free(ext0);
+    free(ext1);
+    merrno = ME_MEM;
+    return -1;
+  }
+
+  /* the range of the left and right edges of all page sets, and the
+     vertical range of the ink */
+  lo0 = lo1 = a = max(info.canvas_w, info.canvas_h);
+  hi0 = hi1 = b = 0;
+  for (j=0; j<n; j++) {
+    bboxes[j] = coarse[j];
+    if (coarse[j].x0 < coarse[j].x1) {
+      lo0 = min(lo0, coarse[j].x0);
+      hi0 = max(hi0, coarse[j].x0);
+      lo1 = min(lo1, coarse[j].x1);
+      hi1 = max(hi1, coarse[j].x1);
+      a = min(a, coarse[j].y0);
+      b = max(b, coarse[j].y1);
+    }
+  }
+  if (hi1 == 0) {
+    /* blank document */
+    r = 1;
+    goto done;
+  }
+
+  /* left and right edges, in one strip if they are close together */
+  lo0 -= MARGIN;
+  hi0 += SCALE + MARGIN;
+  lo1 -= SCALE + MARGIN;
+  hi1 += MARGIN;
+  a -= MARGIN;
+  b += MARGIN;
+  if (hi0 >= lo1) {
+    r = fine(doc, n, pages, coarse, lo0, a, hi1, b, LEFT|RIGHT|BOTTOM|TOP, ext0);
+    memcpy(ext1, ext0, n * sizeof(bbox_t));
+  } else {
+    r = fine(doc, n, pages, coarse, lo0, a, hi0, b, LEFT|BOTTOM|TOP, ext0);
+    if (r == 1) {
+      r = fine(doc, n, pages, coarse, lo1, a, hi1, b, RIGHT|BOTTOM|TOP, ext1);
+    }
+  }
+  if (r != 1) {
+    goto done;
+  }
+
+  /* the horizontal range of the ink is now exact */
+  lo0 = lo1 = a = max(info.canvas_w, info.canvas_h);
+  hi0 = hi1 = b = 0;
+  for (j=0; j<n; j++) {
+    if (coarse[j].x0 < coarse[j].x1) {
+      bboxes[j].x0 = ext0[j].x0;
+      bboxes[j].x1 = ext1[j].x1;
+      a = min(a, bboxes[j].x0);
+      b = max(b, bboxes[j].x1);
+      lo0 = min(lo0, coarse[j].y0);
+      hi0 = max(hi0, coarse[j].y0);
+      lo1 = min(lo1, coarse[j].y1);
+      hi1 = max(hi1, coarse[j].y1);
+    }
+  }
+
+  /* bottom and top edges */
+  lo0 -= MARGIN;
+  hi0 += SCALE + MARGIN;
+  lo1 -= SCALE + MARGIN;
+  hi1 += MARGIN;
+  if (hi0 >= lo1) {
+    r = fine(doc, n, pages, coarse, a, lo0, b, hi1, BOTTOM|TOP, ext0);
+    memcpy(ext1, ext0, n * sizeof(bbox_t));
+  } else {
+    r = fine(doc, n, pages, coarse, a, lo0, b, hi0, BOTTOM, ext0);
+    if (r == 1) {
+      r = fine(doc, n, pages, coarse, a, lo1, b, hi1, TOP, ext1);
+    }
+  }
+  if (r != 1) {
+    goto done;
+  }
+  for (j=0; j<n; j++) {
+    if (coarse[j].x0 < coarse[j].x1) {
+      bboxes[j].y0 = ext0[j].y0;
+      bboxes[j].y1 = ext1[j].y1;
+    }
+  }
+
+ done:
+  free(ext0);
+  free(ext1);
+  return r;
+}
+
+/* like psdim without percentiles, but render coarse-to-fine. Return
+   0 on success, or -1 with merrno set. */
+
+int psdim_adaptive(char *infile, int n, bbox_t *bboxes) {
+  doc_t doc;
+  window_t win;
+  bbox_t *coarse;
+  hist_t *hist;
+  percentile_t exact = {0.0, 1.0, 0.0, 1.0};
+  int pages, r, quiet, anchor, moved;
+
+  coarse = (bbox_t *)malloc(n * sizeof(bbox_t));
+  if (!coarse) {
+    merrno = ME_MEM;
+    return -1;
+  }
+  if (doc_open(infile, &doc)) {
+    free(coarse);
+    return -1;
+  }
+
+  /* the coarse pass shows progress; the strips are quiet. Its window
+     is the canvas, rounded up to whole coarse pixels. */
+  win.x = win.y = 0;
+  win.w = (info.canvas_w + SCALE-1) / SCALE * SCALE;
+  win.h = (info.canvas_h + SCALE-1) / SCALE * SCALE;
+  win.res = 72/SCALE;
+  win.pagesize = 1;
+  pages = render_extents(&doc, &win, n, coarse, &anchor, &moved);
+  progress_done();
+  if (pages < 0) {
+    r = -1;
+    goto done;
+  }
+  quiet = info.quiet;
+  info.quiet = 1;
+  /* the strips are rendered on media of their own size, so pages
+     placed relative to the top of the media cannot be rendered in
+     strips */
+  r = moved ? 0 : refine(&doc, n, pages, coarse, bboxes);
+  if (r == 0) {
+    /* inconclusive; render the whole canvas */
+    hist = hist_new(n, info.canvas_w, info.canvas_h);
+    if (!hist) {
+      r = -1;
+    } else {
+      hist->exact = 1;
+      r = render_range(&doc, 0, -1, 0, NULL, hist);
+      if (r >= 0) {
+	hist_bboxes(hist, bboxes, &exact);
+      }
+      hist_free(hist);
+    }
+  } else if (r == 1 && anchor) {
+    /* no page reported its size */
+    bbox_anchor(n, bboxes, info.canvas_h);
+  }
+  info.quiet = quiet;
+  r = r < 0 ? -1 : 0;
+
+ done:
+  doc_close(&doc);
+  free(coarse);
+  return r;
+}
@@ -0,0 +1,215 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* searching for the best layout. The document is rendered once, and
+   the counts of each page are kept, so that the bounding boxes of the
+   page sets can be calculated for any number of pages per sheet
+   without rendering it again. Every grid of rows and columns, from
+   the number of pages per sheet given by the layout options up to a
+   limit, is tried in each orientation, numbering mode and alignment
+   policy. The scaling factor shrinks as the number of pages per
+   sheet grows, so the layouts are ranked by the part of the sheet
+   that their scaled pages cover, sf*sf*n, instead. Layouts that place
+   every page the same way are only listed once. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "format.h"
+#include "auto.h"
+
+/* a candidate layout */
+struct layout_s {
+  int rows, cols;       /* grid */
+  int land;             /* orientation, as in info */
+  int columnmode;       /* page numbers go in columns? */
+  int hpolicy, vpolicy; /* alignment policies */
+  double sf;            /* its scaling factor */
+  double cover;         /* part of the sheet its pages cover */
+  int order;            /* order in which it was tried */
+};
+typedef struct layout_s layout_t;
+
+/* the option that selects each orientation */
+static char *orientation[4] = { "-P", "-L", "-U", "-R" };
+
+/* largest cover first, and otherwise in the order tried */
+static int by_cover(const void *a, const void *b) {
+  const layout_t *la = (const layout_t *)a;
+  const layout_t *lb = (const layout_t *)b;
+
+  if (la->cover != lb->cover) {
+    return la->cover > lb->cover ? -1 : 1;
+  }
+  return la->order - lb->order;
+}
+
+/* do the transforms a and b of n pages print the same with the
+   options of in? */
+static int same_transforms(info_t in, int n, transform_t *a, transform_t *b) {
+  int k;
+
+  for (k=0; k<n; k++) {
+    if (strcmp(a[k].rot, b[k].rot) != 0
+	|| fabs(a[k].sf - b[k].sf) >= 0.0005
+	|| fabs(a[k].dx - b[k].dx) >= 0.0005 * DEFAULT_UNIT_POINTS
+	|| fabs(a[k].dy - b[k].dy) >= 0.0005 * DEFAULT_UNIT_POINTS) {
+      return 0;
+    }
+    if (in.clip
+	&& (fabs(a[k].x0p - b[k].x0p) >= 0.0005 * DEFAULT_UNIT_POINTS
+	    || fabs(a[k].y0p - b[k].y0p) >= 0.0005 * DEFAULT_UNIT_POINTS
+	    || fabs(a[k].x1p - b[k].x1p) >= 0.0005 * DEFAULT_UNIT_POINTS
+	    || fabs(a[k].y1p - b[k].y1p) >= 0.0005 * DEFAULT_UNIT_POINTS)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* set the layout options of in to those of l */
+static void layout_info(info_t *in, layout_t *l) {
+  in->rows = l->rows;
+  in->cols = l->cols;
+  in->land = l->land;
+  in->columnmode = l->columnmode;
+  in->hpolicy = l->hpolicy;
+  in->vpolicy = l->vpolicy;
+}
+
+/* find the layouts with between info.rows*info.cols and max pages per
+   sheet that give the pages of hist, which must have been made with
+   psdim_pages, the largest cover. Output the page specification of
+   the best one, or, if top is more than 1, the top best different
+   ones, each preceded by its cover and the options that select it.
+   Return 0 on success, or -1 with merrno set. */
+
+int psdim_auto(hist_t *hist, percentile_t *percentile, int max, int top) {
+  layout_t *layouts = NULL, *tmp, *l;
+  bbox_t **bboxes;
+  transform_t *tr, *shown = NULL;
+  hist_t *group;
+  info_t in;
+  int *shown_n = NULL;
+  int lo, n, r, land, cm, hp, vp, count = 0, size = 0, i, j, k, ret = -1;
+
+  lo = info.rows * info.cols;
+  if (lo > max) {
+    lo = max;
+  }
+  bboxes = (bbox_t **)calloc(max+1, sizeof(bbox_t *));
+  tr = (transform_t *)malloc(max * sizeof(transform_t));
+  if (!bboxes || !tr) {
+    free(bboxes);
+    free(tr);
+    merrno = ME_MEM;
+    return -1;
+  }
+
+  for (n=lo; n<=max; n++) {
+    /* the bounding boxes of n page sets */
+    group = hist_regroup(hist, n);
+    bboxes[n] = (bbox_t *)malloc(n * sizeof(bbox_t));
+    if (!group || !bboxes[n]) {
+      hist_free(group);
+      merrno = ME_MEM;
+      goto done;
+    }
+    hist_bboxes(group, bboxes[n], percentile);
+    hist_free(group);
+    adjust(info, n, bboxes[n]);
+
+    for (r=1; r<=n; r++) {
+      if (n % r) {
+	continue;
+      }
+      for (land=0; land<4; land++) {
+	/* a single row or column is numbered the same either way */
+	for (cm=0; cm < (r == 1 || r == n ? 1 : 2); cm++) {
+	  for (hp=0; hp<5; hp++) {
+	    for (vp=0; vp<5; vp++) {
+	      if (count == size) {
+		size = size ? 2*size : 256;
+		tmp = (layout_t *)realloc(layouts, size * sizeof(layout_t));
+		if (!tmp) {
+		  merrno = ME_MEM;
+		  goto done;
+		}
+		layouts = tmp;
+	      }
+	      l = &layouts[count];
+	      l->rows = r;
+	      l->cols = n / r;
+	      l->land = land;
+	      l->columnmode = cm;
+	      l->hpolicy = hp;
+	      l->vpolicy = vp;
+	      l->order = count;
+	      in = info;
+	      layout_info(&in, l);
+	      l->sf = format_layout(in, n, bboxes[n], tr);
+	      l->cover = l->sf * l->sf * n;
+	      count++;
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  qsort(layouts, count, sizeof(layout_t), by_cover);
+
+  /* the transforms of the layouts output so far, max for each */
+  k = top < count ? top : count;
+  shown = (transform_t *)malloc(k * max * sizeof(transform_t));
+  shown_n = (int *)malloc(k * sizeof(int));
+  if (!shown || !shown_n) {
+    merrno = ME_MEM;
+    goto done;
+  }
+  k = 0;
+  for (i=0; i<count && k<top; i++) {
+    l = &layouts[i];
+    n = l->rows * l->cols;
+    in = info;
+    layout_info(&in, l);
+    format_layout(in, n, bboxes[n], tr);
+    for (j=0; j<k; j++) {
+      if (shown_n[j] == n && same_transforms(in, n, &shown[j*max], tr)) {
+	break;
+      }
+    }
+    if (j < k) {
+      continue;
+    }
+    memcpy(&shown[k*max], tr, n * sizeof(transform_t));
+    shown_n[k++] = n;
+    if (top > 1) {
+      printf("%0.3f\t-f %dx%d %s -a %d -b %d%s\t", l->cover, l->rows, l->cols,
+	     orientation[l->land], l->hpolicy, l->vpolicy, l->columnmode ? " -c" : "");
+    }
+    format_print(in, n, tr);
+  }
+  ret = 0;
+
+ done:
+  for (n=0; n<=max; n++) {
+    free(bboxes[n]);
+  }
+  free(bboxes);
+  free(tr);
+  free(shown);
+  free(shown_n);
+  free(layouts);
+  return ret;
+}
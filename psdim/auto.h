@@ -0,0 +1,16 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef AUTO_H
+#define AUTO_H
+
+#include "main.h"
+#include "psdim.h"
+
+#define AUTO_MAX 64     /* most pages per sheet that --auto may try */
+
+int psdim_auto(hist_t *hist, percentile_t *percentile, int max, int top);
+
+#endif /* AUTO_H */
@@ -0,0 +1,330 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* measuring many documents in one run. The documents are split into
+   chunks of consecutive pages, and the chunks of all documents are
+   put in a single queue. A fixed number of workers render them, each
+   chunk in a ghostscript of its own; whenever a worker is done, it
+   takes the next chunk from the queue. The pages of a long document
+   are thus spread over all workers, instead of keeping one of them
+   busy while the others are idle. Each document has its own
+   histogram, and its page format is output as soon as it and all
+   documents before it are done, in the order in which they were
+   given. With --common-layout, the histograms of all documents are
+   merged instead, and a single page format that suits all of them is
+   output. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "format.h"
+#include "jobs.h"
+#include "batch.h"
+
+#define CHUNK_MIN   8   /* fewest pages in a chunk, to make up for starting ghostscript */
+#define CHUNK_SPLIT 4   /* aim for this many chunks per worker */
+
+/* a document of the batch */
+struct bdoc_s {
+  char *name;       /* its file name */
+  doc_t doc;        /* the document */
+  int open;         /* is doc open? */
+  hist_t *hist;     /* its ink, or NULL */
+  int pending;      /* chunks that are queued or being rendered */
+  int mismatch;     /* did a chunk render an unexpected number of pages? */
+  int retried;      /* has it been queued as a whole after a mismatch? */
+  int err;          /* merrno of the first error, or 0 */
+};
+typedef struct bdoc_s bdoc_t;
+
+/* a chunk of work: pages a..b-1 of document d, or all of it if b is -1 */
+struct chunk_s {
+  int d;
+  int a, b;
+};
+typedef struct chunk_s chunk_t;
+
+/* the queue of chunks */
+static chunk_t *queue = NULL;
+static int queued = 0, queuesize = 0;
+
+/* add a chunk to the queue. Return 0 on success, or -1 with merrno
+   set. */
+static int enqueue(int d, int a, int b) {
+  chunk_t *tmp;
+
+  if (queued == queuesize) {
+    queuesize = queuesize ? 2*queuesize : 64;
+    tmp = (chunk_t *)realloc(queue, queuesize * sizeof(chunk_t));
+    if (!tmp) {
+      merrno = ME_MEM;
+      return -1;
+    }
+    queue = tmp;
+  }
+  queue[queued].d = d;
+  queue[queued].a = a;
+  queue[queued].b = b;
+  queued++;
+  return 0;
+}
+
+/* report an error of document d, with merrno set, unless one was
+   already reported */
+static void batch_error(bdoc_t *d) {
+  if (d->err) {
+    return;
+  }
+  d->err = merrno;
+  if (merrno != ME_IO) {
+    fprintf(stderr, ""PSDIM": %s: %s\n", d->name, mstrerror[merrno]);
+  } else {
+    fprintf(stderr, ""PSDIM": %s: %s\n", d->name, strerror(errno));
+  }
+}
+
+/* output the page format of document d, or an empty line if it
+   could not be measured */
+static void batch_output(bdoc_t *d, int n, bbox_t *bboxes) {
+  if (d->err) {
+    printf("\n");
+  } else {
+    hist_bboxes(d->hist, bboxes, &info.percentile);
+    adjust(info, n, bboxes);
+    format(info, n, bboxes);
+  }
+  fflush(stdout);
+}
+
+/* collect the result of worker w, which renders a chunk of document
+   d. If the chunk came out wrong, queue the document to be rendered
+   again as a whole. */
+static void batch_finish(bdoc_t *d, int dn, worker_t *w) {
+  hist_t *tmp;
+  int r;
+
+  tmp = hist_new(d->hist->n, d->hist->w, d->hist->h);
+  r = tmp ? finish_worker(w, d->hist, tmp, 0) : -1;
+  hist_free(tmp);
+  d->pending--;
+  if (r < 0) {
+    batch_error(d);
+  } else if (w->b != -1 && r != w->b - w->a) {
+    d->mismatch = 1;
+  }
+  if (d->pending == 0 && d->mismatch && !d->err && !d->retried) {
+    hist_clear(d->hist);
+    d->retried = 1;
+    if (enqueue(dn, 0, -1)) {
+      batch_error(d);
+    } else {
+      d->pending++;
+    }
+  }
+}
+
+/* measure the count documents files[0..count-1] with up to jobs
+   concurrent ghostscript processes (or as many as there are
+   processors, if jobs is 0), and output their page formats. Return 0
+   on success, or the merrno code of an error. */
+
+int psdim_batch(char **files, int count, int jobs) {
+  bdoc_t *docs;
+  worker_t *w;
+  int *wd;
+  struct pollfd *fds;
+  bbox_t *bboxes;
+  hist_t *all;
+  int i, j, k, n, exact, pages, size, parts, next, running, out, err;
+  int canvas_w, canvas_h, max_w, max_h;
+
+  if (jobs < 1) {
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = jobs < 1 ? 1 : jobs;
+  }
+  n = info.rows * info.cols;
+  docs = (bdoc_t *)calloc(count, sizeof(bdoc_t));
+  w = (worker_t *)malloc(jobs * sizeof(worker_t));
+  wd = (int *)malloc(jobs * sizeof(int));
+  fds = (struct pollfd *)malloc(jobs * sizeof(struct pollfd));
+  bboxes = (bbox_t *)malloc(n * sizeof(bbox_t));
+  if (!docs || !w || !wd || !fds || !bboxes) {
+    fprintf(stderr, ""PSDIM": %s\n", mstrerror[ME_MEM]);
+    return ME_MEM;
+  }
+  exact = !info.color && info.percentile.x0 == 0.0 && info.percentile.x1 == 1.0
+    && info.percentile.y0 == 0.0 && info.percentile.y1 == 1.0;
+
+  /* open the documents and choose their canvases. A common layout
+     needs a common canvas, so that the histograms can be merged. */
+  canvas_w = info.canvas_w;
+  canvas_h = info.canvas_h;
+  max_w = max_h = 0;
+  pages = 0;
+  for (i=0; i<count; i++) {
+    docs[i].name = files[i];
+    if (doc_open(files[i], &docs[i].doc)) {
+      batch_error(&docs[i]);
+      continue;
+    }
+    docs[i].open = 1;
+    info.canvas_w = canvas_w;
+    info.canvas_h = canvas_h;
+    canvas_setup(files[i]);
+    docs[i].hist = hist_canvas(n, info.color);
+    if (!docs[i].hist) {
+      batch_error(&docs[i]);
+      continue;
+    }
+    docs[i].hist->exact = exact;
+    max_w = info.canvas_w > max_w ? info.canvas_w : max_w;
+    max_h = info.canvas_h > max_h ? info.canvas_h : max_h;
+    pages += docs[i].doc.pages > 0 ? docs[i].doc.pages : 1;
+  }
+  for (i=0; i<count && info.common_layout; i++) {
+    if (!docs[i].err && hist_grow(docs[i].hist, canvas_pixels(max_w),
+				  canvas_pixels(max_h))) {
+      batch_error(&docs[i]);
+    }
+  }
+
+  /* split the documents into chunks. Documents whose pages cannot be
+     located are a single chunk. */
+  size = (pages + CHUNK_SPLIT*jobs - 1) / (CHUNK_SPLIT*jobs);
+  if (size < CHUNK_MIN) {
+    size = CHUNK_MIN;
+  }
+  for (i=0; i<count; i++) {
+    if (docs[i].err) {
+      continue;
+    }
+    pages = docs[i].doc.pages;
+    parts = pages > 0 ? (pages + size - 1) / size : 0;
+    if (parts == 0) {
+      k = enqueue(i, 0, -1);
+      docs[i].pending = 1;
+    } else {
+      for (j=0, k=0; j<parts && k==0; j++) {
+	k = enqueue(i, (long)j*pages/parts, (long)(j+1)*pages/parts);
+      }
+      docs[i].pending = parts;
+    }
+    if (k) {
+      fprintf(stderr, ""PSDIM": %s\n", mstrerror[ME_MEM]);
+      return ME_MEM;
+    }
+  }
+
+  /* hand out the chunks, and output the documents in order as they
+     are completed */
+  for (k=0; k<jobs; k++) {
+    w[k].pid = 0;
+  }
+  next = 0;
+  running = 0;
+  out = 0;
+  while (1) {
+    while (!info.common_layout && out < count && docs[out].pending == 0) {
+      batch_output(&docs[out], n, bboxes);
+      progress_page(out+1);
+      out++;
+    }
+    if (next == queued && running == 0) {
+      break;
+    }
+
+    for (k=0; k<jobs && next<queued; k++) {
+      if (w[k].pid) {
+	continue;
+      }
+      i = queue[next].d;
+      next++;
+      if (docs[i].err) {
+	docs[i].pending--;
+	continue;
+      }
+      if (start_worker(&docs[i].doc, queue[next-1].a, queue[next-1].b,
+		       info.color, docs[i].hist, &w[k])) {
+	w[k].pid = 0;
+	docs[i].pending--;
+	batch_error(&docs[i]);
+	continue;
+      }
+      wd[k] = i;
+      running++;
+    }
+    if (running == 0) {
+      continue;
+    }
+
+    /* wait for a worker to send its result */
+    for (k=0; k<jobs; k++) {
+      fds[k].fd = w[k].pid ? w[k].fd : -1;
+      fds[k].events = POLLIN;
+      fds[k].revents = 0;
+    }
+    if (poll(fds, jobs, -1) == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      fprintf(stderr, ""PSDIM": %s\n", strerror(errno));
+      return ME_IO;
+    }
+    for (k=0; k<jobs; k++) {
+      if (w[k].pid && fds[k].revents) {
+	batch_finish(&docs[wd[k]], wd[k], &w[k]);
+	w[k].pid = 0;
+	running--;
+      }
+    }
+  }
+  progress_done();
+
+  /* the common layout */
+  err = 0;
+  all = NULL;
+  for (i=0; i<count; i++) {
+    if (docs[i].err) {
+      err = docs[i].err;
+    } else if (info.common_layout && !all) {
+      all = docs[i].hist;
+    } else if (info.common_layout) {
+      hist_merge(all, docs[i].hist);
+    }
+  }
+  if (info.common_layout) {
+    if (all) {
+      hist_bboxes(all, bboxes, &info.percentile);
+      adjust(info, n, bboxes);
+      format(info, n, bboxes);
+    } else {
+      printf("\n");
+    }
+  }
+
+  for (i=0; i<count; i++) {
+    if (docs[i].open) {
+      doc_close(&docs[i].doc);
+    }
+    hist_free(docs[i].hist);
+  }
+  free(docs);
+  free(w);
+  free(wd);
+  free(fds);
+  free(bboxes);
+  free(queue);
+  return err;
+}
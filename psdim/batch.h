@@ -0,0 +1,11 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+int psdim_batch(char **files, int count, int jobs);
+
+#endif /* BATCH_H */
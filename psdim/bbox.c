@@ -0,0 +1,178 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* measuring a document with ghostscript's bbox device. This device
+   reports the bounding box of the marks on each page without
+   rasterizing anything, which is much faster than counting pixels.
+   Painting in white does not count as a mark, just as white pixels
+   are not ink in the bitmap. Percentiles cannot be computed this
+   way. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "bbox.h"
+#include "scan.h"
+#include "perpage.h"
+
+/* add a page whose marks lie inside the rectangle x0,y0,x1,y1 (in
+   points) to the bounding box b, on a canvas of w x h points. The
+   rectangle is rounded to the pixels that the bitmap would have
+   inked. Empty rectangles are ignored. */
+
+void bbox_fold(bbox_t *b, double x0, double y0, double x1, double y1, int w, int h) {
+  int px0, py0, px1, py1;
+
+  px0 = (int)floor(x0);
+  py0 = (int)floor(y0);
+  px1 = (int)ceil(x1);
+  py1 = (int)ceil(y1);
+  px0 = px0 < 0 ? 0 : px0;
+  py0 = py0 < 0 ? 0 : py0;
+  px1 = px1 > w ? w : px1;
+  py1 = py1 > h ? h : py1;
+  if (px0 >= px1 || py0 >= py1) {
+    return;
+  }
+  if (px0 < b->x0) {
+    b->x0 = px0;
+  }
+  if (py0 < b->y0) {
+    b->y0 = py0;
+  }
+  if (px1 > b->x1) {
+    b->x1 = px1;
+  }
+  if (py1 > b->y1) {
+    b->y1 = py1;
+  }
+}
+
+/* apply anchor_fixup to the exact bounding boxes of n page sets on
+   a canvas of height h. Empty boxes have x0 >= x1. */
+
+void bbox_anchor(int n, bbox_t *bboxes, int h) {
+  int j, top, bot;
+
+  top = 0;
+  bot = h;
+  for (j=0; j<n; j++) {
+    if (bboxes[j].x0 < bboxes[j].x1) {
+      top = bboxes[j].y1-1 > top ? bboxes[j].y1-1 : top;
+      bot = bboxes[j].y0 < bot ? bboxes[j].y0 : bot;
+    }
+  }
+  anchor_fixup(n, bboxes, h, top, bot);
+}
+
+/* like psdim, but read the bounding box of each page from the bbox
+   device, and ignore percentiles. Return 0 on success, or -1 with
+   merrno set. */
+
+int psdim_bbox(char *infile, int n, bbox_t *bboxes) {
+  FILE *f;
+  char *argv[GS_ARGS];
+  char line[BUFSIZ];
+  char width[40], height[40];
+  double x0, y0, x1, y1, size = 0.0;
+  bbox_t page;
+  pagestat_t st;
+  pid_t pid;
+  int i, j, p, shift, sized = 0;
+
+  i = 0;
+  argv[i++] = GS;
+  argv[i++] = "-q";
+  argv[i++] = "-dNOPAUSE";
+  argv[i++] = "-sDEVICE=bbox";
+  sprintf(width, "-dDEVICEWIDTHPOINTS=%d", info.canvas_w);
+  sprintf(height, "-dDEVICEHEIGHTPOINTS=%d", info.canvas_h);
+  argv[i++] = width;
+  argv[i++] = height;
+  argv[i++] = "-";
+  argv[i] = NULL;
+  i = gs_fast(argv, i);
+  i = gs_pagesize(argv, i);
+  if (gs_input(argv, i, infile)) {
+    return -1;
+  }
+
+  /* the bounding boxes are reported on stderr */
+  f = gs_open(argv, -1, 2, &pid);
+  if (!f) {
+    return -1;
+  }
+
+  for (j=0; j<n; j++) {
+    bboxes[j].x0 = info.canvas_w;
+    bboxes[j].y0 = info.canvas_h;
+    bboxes[j].x1 = 0;
+    bboxes[j].y1 = 0;
+  }
+
+  p = 0;  /* page counter */
+  while (fgets(line, BUFSIZ, f) != NULL) {
+    if (strncmp(line, "%%psdim-page ", 13) == 0) {
+      /* the page size that the next page asked for, from the prelude */
+      if (sscanf(line+13, "%lf %lf", &x0, &size) != 2) {
+	size = 0.0;
+      }
+      sized = 1;
+    } else if (strncmp(line, "%%HiResBoundingBox:", 19) == 0) {
+      page.x0 = info.canvas_w;
+      page.y0 = info.canvas_h;
+      page.x1 = page.y1 = 0;
+      if (sscanf(line+19, "%lf %lf %lf %lf", &x0, &y0, &x1, &y1) == 4) {
+	bbox_fold(&page, x0, y0, x1, y1, info.canvas_w, info.canvas_h);
+      }
+      /* move a page placed relative to the top of the canvas to the
+	 bottom, as hist_page does */
+      shift = info.canvas_h - (int)ceil(size);
+      if (size > 0.0 && shift > 0 && page.y1 > info.canvas_h - shift
+	  && page.y0 >= shift) {
+	page.y0 -= shift;
+	page.y1 -= shift;
+      }
+      size = 0.0;
+      if (page.x0 < page.x1) {
+	bbox_fold(&bboxes[p % n], page.x0, page.y0, page.x1, page.y1,
+		  info.canvas_w, info.canvas_h);
+      }
+      p++;
+      if (info.perpage) {
+	/* the bbox device does not count pixels */
+	st.page = p;
+	st.x0 = page.x0;
+	st.y0 = page.y0;
+	st.x1 = page.x1;
+	st.y1 = page.y1;
+	st.ink = -1;
+	perpage_page(&st);
+      }
+      progress_page(p);
+    } else if (strncmp(line, "%%BoundingBox:", 14) != 0) {
+      /* pass on ghostscript's own messages */
+      fputs(line, stderr);
+    }
+  }
+  progress_done();
+  if (gs_close(f, pid)) {
+    return -1;
+  }
+
+  /* the page sizes make the anchor heuristic unnecessary */
+  if (!sized) {
+    bbox_anchor(n, bboxes, info.canvas_h);
+  }
+  return 0;
+}
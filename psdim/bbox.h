@@ -0,0 +1,15 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef BBOX_H
+#define BBOX_H
+
+#include "main.h"
+
+void bbox_fold(bbox_t *b, double x0, double y0, double x1, double y1, int w, int h);
+void bbox_anchor(int n, bbox_t *bboxes, int h);
+int psdim_bbox(char *infile, int n, bbox_t *bboxes);
+
+#endif /* BBOX_H */
@@ -0,0 +1,377 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* a persistent cache of measured bounding boxes. Each entry is a
+   small file, named after a hash of its key, which is made from a
+   hash of the document and the options that affect the measurement.
+   The key is also stored in the entry and compared on lookup, so a
+   hash collision only costs a cache miss. Entries are written to a
+   temporary file and renamed into place, so that concurrent psdim
+   processes never see a partial entry. The modification time of an
+   entry is its last use; when the cache grows beyond its size
+   limit, the least recently used entries are removed. Failing to
+   read or write the cache is never an error. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <utime.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "jobs.h"
+#include "cache.h"
+
+#define CACHE_MAGIC "psdim-cache 2"  /* changes with the file format or the key */
+#define KEYLEN 512    /* room for a key */
+#define STALE 3600    /* age of abandoned temporary files, in seconds */
+
+/* ---------------------------------------------------------------------- */
+/* hashing */
+
+#define M1 0x9e3779b97f4a7c15ULL
+#define M2 0xbf58476d1ce4e5b9ULL
+
+static uint64_t mix(uint64_t h, uint64_t w) {
+  h ^= w * M1;
+  h = (h << 31 | h >> 33) * M2;
+  return h;
+}
+
+/* hash the contents of the file f, a word at a time, and store its
+   length in *len. Return the hash, or 0 with merrno set on error. */
+static uint64_t hash_file(FILE *f, long long *len) {
+  unsigned char buf[65536];
+  uint64_t h = 0, w;
+  size_t r, i;
+
+  *len = 0;
+  while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
+    *len += r;
+    /* zero-pad the final word; only the last block can be short */
+    while (r % 8) {
+      buf[r++] = 0;
+    }
+    for (i=0; i<r; i+=8) {
+      memcpy(&w, buf+i, 8);
+      h = mix(h, w);
+    }
+  }
+  if (ferror(f)) {
+    merrno = ME_IO;
+    return 0;
+  }
+  h = mix(h, (uint64_t)*len);
+  return h ? h : 1;
+}
+
+/* hash a string */
+static uint64_t hash_string(char *s) {
+  uint64_t h = 0;
+
+  while (*s) {
+    h = mix(h, (unsigned char)*s++);
+  }
+  return h;
+}
+
+/* ---------------------------------------------------------------------- */
+/* the cache directory */
+
+/* return the cache directory, creating it if necessary, or NULL if
+   there is none. The result is malloc'ed. */
+static char *cache_dir(void) {
+  char *dir, *base, *home;
+
+  if (info.cachedir) {
+    dir = strdup(info.cachedir);
+  } else {
+    base = getenv("XDG_CACHE_HOME");
+    home = getenv("HOME");
+    if (base && *base) {
+      dir = (char *)malloc(strlen(base) + 16);
+      if (dir) {
+	mkdir(base, 0700);
+	sprintf(dir, "%s/"PSDIM, base);
+      }
+    } else if (home && *home) {
+      dir = (char *)malloc(strlen(home) + 16);
+      if (dir) {
+	sprintf(dir, "%s/.cache", home);
+	mkdir(dir, 0700);
+	strcat(dir, "/"PSDIM);
+      }
+    } else {
+      return NULL;
+    }
+  }
+  if (dir && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+    free(dir);
+    return NULL;
+  }
+  return dir;
+}
+
+struct entry_s {
+  char *name;
+  time_t mtime;
+  off_t size;
+};
+typedef struct entry_s entry_t;
+
+static int by_mtime(const void *a, const void *b) {
+  const entry_t *ea = (const entry_t *)a;
+  const entry_t *eb = (const entry_t *)b;
+
+  return ea->mtime < eb->mtime ? -1 : ea->mtime > eb->mtime ? 1 : 0;
+}
+
+/* remove the least recently used entries of the cache in dir until
+   it holds at most info.cachesize kilobytes, as well as abandoned
+   temporary files. Entries that another process removes first are
+   skipped. */
+static void cache_evict(char *dir) {
+  DIR *d;
+  struct dirent *de;
+  struct stat st;
+  entry_t *e = NULL, *tmp;
+  int count = 0, size = 0, i;
+  long long total = 0;
+  char *path;
+  time_t now = time(NULL);
+
+  d = opendir(dir);
+  if (!d) {
+    return;
+  }
+  path = (char *)malloc(strlen(dir) + 256 + 2);
+  if (!path) {
+    closedir(d);
+    return;
+  }
+  while ((de = readdir(d)) != NULL) {
+    if (strlen(de->d_name) > 255 || strcmp(de->d_name, ".") == 0
+	|| strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    sprintf(path, "%s/%s", dir, de->d_name);
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (de->d_name[0] == '.') {
+      if (now - st.st_mtime > STALE) {
+	unlink(path);
+      }
+      continue;
+    }
+    if (count == size) {
+      size = size ? 2*size : 64;
+      tmp = (entry_t *)realloc(e, size * sizeof(entry_t));
+      if (!tmp) {
+	break;
+      }
+      e = tmp;
+    }
+    e[count].name = strdup(de->d_name);
+    if (!e[count].name) {
+      break;
+    }
+    e[count].mtime = st.st_mtime;
+    e[count].size = st.st_size;
+    total += st.st_size;
+    count++;
+  }
+  closedir(d);
+
+  qsort(e, count, sizeof(entry_t), by_mtime);
+  for (i=0; i<count && total > info.cachesize * 1024LL; i++) {
+    sprintf(path, "%s/%s", dir, e[i].name);
+    unlink(path);
+    total -= e[i].size;
+  }
+  for (i=0; i<count; i++) {
+    free(e[i].name);
+  }
+  free(e);
+  free(path);
+}
+
+/* ---------------------------------------------------------------------- */
+/* entries */
+
+/* look up the entry for key in the file path, and read n bounding
+   boxes from it. Return 0 on a hit, else -1. */
+static int cache_read(char *path, char *key, int n, bbox_t *bboxes) {
+  FILE *f;
+  char line[KEYLEN+16];
+  int j, r = -1;
+
+  f = fopen(path, "r");
+  if (!f) {
+    return -1;
+  }
+  if (!fgets(line, sizeof(line), f) || strcmp(line, CACHE_MAGIC"\n") != 0) {
+    goto done;
+  }
+  if (!fgets(line, sizeof(line), f) || strncmp(line, "key ", 4) != 0
+      || strncmp(line+4, key, strlen(key)) != 0 || line[4+strlen(key)] != '\n') {
+    goto done;
+  }
+  for (j=0; j<n; j++) {
+    if (fscanf(f, " bbox %d %d %d %d", &bboxes[j].x0, &bboxes[j].y0,
+	       &bboxes[j].x1, &bboxes[j].y1) != 4) {
+      goto done;
+    }
+  }
+  r = 0;
+  /* mark the entry as recently used */
+  utime(path, NULL);
+
+ done:
+  fclose(f);
+  return r;
+}
+
+/* store n bounding boxes under key in the file path of the cache
+   directory dir, replacing any previous entry atomically */
+static void cache_write(char *dir, char *path, char *key, int n, bbox_t *bboxes) {
+  char *tmppath;
+  FILE *f;
+  int fd, j, err;
+
+  tmppath = (char *)malloc(strlen(dir) + 16);
+  if (!tmppath) {
+    return;
+  }
+  sprintf(tmppath, "%s/.tmpXXXXXX", dir);
+  fd = mkstemp(tmppath);
+  if (fd == -1) {
+    free(tmppath);
+    return;
+  }
+  f = fdopen(fd, "w");
+  if (!f) {
+    close(fd);
+    unlink(tmppath);
+    free(tmppath);
+    return;
+  }
+  fprintf(f, CACHE_MAGIC"\n");
+  fprintf(f, "key %s\n", key);
+  for (j=0; j<n; j++) {
+    fprintf(f, "bbox %d %d %d %d\n", bboxes[j].x0, bboxes[j].y0,
+	    bboxes[j].x1, bboxes[j].y1);
+  }
+  err = ferror(f);
+  if (fclose(f) || err || rename(tmppath, path) == -1) {
+    unlink(tmppath);
+  }
+  free(tmppath);
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* like psdim or psdim_color (as given by info.color), but look up the
+   result in the cache first, and store it there after measuring.
+   Return 0 on success, or -1 with merrno set. */
+
+int psdim_cached(char *infile, int n, bbox_t *bboxes) {
+  char *dir = NULL, *tmppath = NULL, *path = NULL;
+  char key[KEYLEN];
+  FILE *f;
+  int fd, r;
+  long long len;
+  uint64_t h;
+  struct stat st;
+
+  /* the input is read twice, so stdin is saved to a file first */
+  if (infile) {
+    fd = open(infile, O_RDONLY);
+    if (fd == -1) {
+      merrno = ME_IO;
+      return -1;
+    }
+    fstat(fd, &st);
+    if (S_ISDIR(st.st_mode)) {
+      close(fd);
+      errno = EISDIR;
+      merrno = ME_IO;
+      return -1;
+    }
+  } else {
+    fd = spool_stdin(&tmppath);
+    if (fd == -1) {
+      return -1;
+    }
+    lseek(fd, 0L, SEEK_SET);
+    infile = tmppath;
+  }
+  f = fdopen(fd, "r");
+  if (!f) {
+    close(fd);
+    merrno = ME_IO;
+    r = -1;
+    goto done;
+  }
+  h = hash_file(f, &len);
+  fclose(f);
+  if (!h) {
+    r = -1;
+    goto done;
+  }
+
+  /* everything that affects the bounding boxes, including the
+     version, as another one may measure differently */
+  sprintf(key, "%016llx %lld version=%s n=%d color=%d,%d engine=%d fudge=%.17g,%.17g,%.17g,%.17g"
+	  " sample=%d,%.17g,%.17g canvas=%dx%d res=%d fast=%d,%d",
+	  (unsigned long long)h, len, VERSION, n, info.color, info.gray_threshold, info.engine,
+	  info.percentile.x0, info.percentile.x1, info.percentile.y0,
+	  info.percentile.y1, info.sample, info.sample_fraction,
+	  info.sample_escalate, info.canvas_w, info.canvas_h, info.resolution,
+	  info.fast_images, info.fast_text);
+
+  dir = cache_dir();
+  if (dir) {
+    path = (char *)malloc(strlen(dir) + 24);
+  }
+  if (path) {
+    sprintf(path, "%s/%016llx", dir, (unsigned long long)hash_string(key));
+    if (cache_read(path, key, n, bboxes) == 0) {
+      r = 0;
+      goto done;
+    }
+  }
+
+  if (info.color) {
+    r = psdim_color(infile, n, bboxes, &info.percentile);
+  } else {
+    r = psdim(infile, n, bboxes, &info.percentile);
+  }
+  if (r == 0 && path) {
+    cache_write(dir, path, key, n, bboxes);
+    cache_evict(dir);
+  }
+
+ done:
+  if (tmppath) {
+    unlink(tmppath);
+    free(tmppath);
+  }
+  free(path);
+  free(dir);
+  return r;
+}
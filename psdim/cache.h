@@ -0,0 +1,13 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "main.h"
+
+int psdim_cached(char *infile, int n, bbox_t *bboxes);
+
+#endif /* CACHE_H */
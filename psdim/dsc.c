@@ -0,0 +1,311 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* scanning of DSC comments in PostScript documents. The page scanner
+   follows scanpages() in pstops-clip/psutil.c. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "main.h"
+#include "dsc.h"
+
+#define iscomment(x,y) (strncmp(x,y,strlen(y)) == 0)
+
+/* build the array of pointers to the start of each page of the
+   document f. Return NULL on error with merrno set. A document
+   without %%Page: comments has 0 pages. */
+
+dsc_t *dsc_scan(FILE *f) {
+  char buffer[BUFSIZ];
+  char *comment = buffer+2;
+  int nesting = 0;
+  int maxpages = 100;
+  long record;
+  long *p;
+  dsc_t *dsc;
+
+  dsc = (dsc_t *)malloc(sizeof(dsc_t));
+  if (!dsc) {
+    merrno = ME_MEM;
+    return NULL;
+  }
+  dsc->pages = 0;
+  dsc->pageptr = (long *)malloc(sizeof(long)*maxpages);
+  if (!dsc->pageptr) {
+    free(dsc);
+    merrno = ME_MEM;
+    return NULL;
+  }
+
+  fseek(f, 0L, SEEK_SET);
+  while (record = ftell(f), fgets(buffer, BUFSIZ, f) != NULL) {
+    if (buffer[0] != '%' || buffer[1] != '%') {
+      continue;
+    }
+    if (nesting == 0 && iscomment(comment, "Page:")) {
+      if (dsc->pages >= maxpages-1) {
+	maxpages *= 2;
+	p = (long *)realloc(dsc->pageptr, sizeof(long)*maxpages);
+	if (!p) {
+	  dsc_free(dsc);
+	  merrno = ME_MEM;
+	  return NULL;
+	}
+	dsc->pageptr = p;
+      }
+      dsc->pageptr[dsc->pages++] = record;
+    } else if (iscomment(comment, "BeginDocument") ||
+	       iscomment(comment, "BeginBinary") ||
+	       iscomment(comment, "BeginFile")) {
+      nesting++;
+    } else if (iscomment(comment, "EndDocument") ||
+	       iscomment(comment, "EndBinary") ||
+	       iscomment(comment, "EndFile")) {
+      nesting--;
+    } else if (nesting == 0 && (iscomment(comment, "Trailer") ||
+				iscomment(comment, "EOF"))) {
+      fseek(f, record, SEEK_SET);
+      break;
+    }
+  }
+  if (ferror(f)) {
+    dsc_free(dsc);
+    merrno = ME_IO;
+    return NULL;
+  }
+  dsc->pageptr[dsc->pages] = ftell(f);
+  fseek(f, 0L, SEEK_END);
+  dsc->end = ftell(f);
+  return dsc;
+}
+
+void dsc_free(dsc_t *dsc) {
+  if (dsc) {
+    free(dsc->pageptr);
+    free(dsc);
+  }
+}
+
+/* copy bytes from..to-1 of file descriptor fd to out. Use pread, so
+   that several processes can share fd. Return 0 on success, or -1
+   with merrno set. */
+
+static int copy_range(int fd, long from, long to, int out) {
+  char buf[BUFSIZ];
+  ssize_t r, w;
+  size_t len;
+  char *p;
+
+  while (from < to) {
+    len = to - from < BUFSIZ ? to - from : BUFSIZ;
+    r = pread(fd, buf, len, from);
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      merrno = r ? ME_IO : ME_EOF;
+      return -1;
+    }
+    from += r;
+    for (p = buf; r > 0; p += w, r -= w) {
+      w = write(out, p, r);
+      if (w == -1 && errno == EINTR) {
+	w = 0;
+      } else if (w == -1) {
+	merrno = ME_IO;
+	return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* write a document consisting of the header, pages a..b-1, and the
+   trailer of the document on file descriptor fd to out. Return 0 on
+   success, or -1 with merrno set. */
+
+int dsc_write_range(int fd, dsc_t *dsc, int a, int b, int out) {
+  if (copy_range(fd, 0, dsc->pageptr[0], out)) {
+    return -1;
+  }
+  if (copy_range(fd, dsc->pageptr[a], dsc->pageptr[b], out)) {
+    return -1;
+  }
+  if (copy_range(fd, dsc->pageptr[dsc->pages], dsc->end, out)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* like dsc_write_range, but write the count pages page[0..count-1]
+   (counting from 0) instead of a range. Return 0 on success, or -1
+   with merrno set. */
+
+int dsc_write_pages(int fd, dsc_t *dsc, int *page, int count, int out) {
+  int i, k;
+
+  if (copy_range(fd, 0, dsc->pageptr[0], out)) {
+    return -1;
+  }
+  for (i=0; i<count; i=k) {
+    /* copy runs of consecutive pages in one go */
+    for (k=i+1; k<count && page[k] == page[k-1]+1; k++) {
+    }
+    if (copy_range(fd, dsc->pageptr[page[i]], dsc->pageptr[page[k-1]+1], out)) {
+      return -1;
+    }
+  }
+  if (copy_range(fd, dsc->pageptr[dsc->pages], dsc->end, out)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* read the bounding boxes that the document on file descriptor fd
+   declares: that of page p from its %%PageBoundingBox comment, as
+   x0, y0, x1, y1 in boxes[4*p..4*p+3], and that of the whole document
+   from the %%BoundingBox comment of its header or trailer, in
+   docbox[0..3]. A box that is not declared has x0 = HUGE_VAL.
+   Comments of embedded documents are skipped. Return 0 on success,
+   or -1 with merrno set. */
+
+int dsc_boxes(int fd, dsc_t *dsc, double *boxes, double *docbox) {
+  char buffer[BUFSIZ];
+  char *comment = buffer+2;
+  char *args = NULL;
+  int nesting = 0;
+  int p = -1;  /* the page, -1 in the header, dsc->pages in the trailer */
+  long record;
+  double *box;
+  FILE *f;
+  int i;
+
+  for (i=0; i<dsc->pages; i++) {
+    boxes[4*i] = HUGE_VAL;
+  }
+  docbox[0] = HUGE_VAL;
+
+  i = dup(fd);
+  f = i == -1 ? NULL : fdopen(i, "r");
+  if (!f) {
+    if (i != -1) {
+      close(i);
+    }
+    merrno = ME_IO;
+    return -1;
+  }
+  fseek(f, 0L, SEEK_SET);
+  while (record = ftell(f), fgets(buffer, BUFSIZ, f) != NULL) {
+    while (p < dsc->pages && record >= dsc->pageptr[p+1]) {
+      p++;
+    }
+    if (buffer[0] != '%' || buffer[1] != '%') {
+      continue;
+    }
+    box = NULL;
+    if (iscomment(comment, "BeginDocument") ||
+	iscomment(comment, "BeginBinary") ||
+	iscomment(comment, "BeginFile")) {
+      nesting++;
+    } else if (iscomment(comment, "EndDocument") ||
+	       iscomment(comment, "EndBinary") ||
+	       iscomment(comment, "EndFile")) {
+      nesting--;
+    } else if (nesting != 0) {
+      continue;
+    } else if (iscomment(comment, "PageBoundingBox:") && p >= 0 && p < dsc->pages) {
+      box = boxes + 4*p;
+      args = comment + 16;
+    } else if (iscomment(comment, "BoundingBox:") && (p < 0 || p >= dsc->pages)) {
+      box = docbox;
+      args = comment + 12;
+    }
+    /* "(atend)" leaves the box undeclared until the trailer */
+    if (box && sscanf(args, "%lf %lf %lf %lf", &box[0], &box[1], &box[2], &box[3]) != 4) {
+      box[0] = HUGE_VAL;
+    }
+  }
+  i = ferror(f);
+  fclose(f);
+  if (i) {
+    merrno = ME_IO;
+    return -1;
+  }
+  return 0;
+}
+
+/* find the size of the media that the document on file descriptor
+   fd asks for, from the %%DocumentMedia and %%BoundingBox comments
+   of its header, and store the largest width and height mentioned
+   in *w and *h (in points). The header is read with pread, starting
+   at the current offset of fd, which is left alone. Return 0 on
+   success, or -1 if fd is not seekable or the header does not
+   mention a size. */
+
+int dsc_media(int fd, double *w, double *h) {
+  char buf[DSC_HEADER+1];
+  char name[256];
+  char *line, *next;
+  double x0, y0, x1, y1;
+  off_t off;
+  ssize_t len;
+  int media, found;
+
+  off = lseek(fd, 0, SEEK_CUR);
+  if (off == -1) {
+    return -1;
+  }
+  do {
+    len = pread(fd, buf, DSC_HEADER, off);
+  } while (len == -1 && errno == EINTR);
+  if (len <= 0) {
+    return -1;
+  }
+  buf[len] = 0;
+
+  *w = *h = 0.0;
+  found = 0;
+  media = 0;  /* in a %%DocumentMedia list? */
+  for (line = buf; line < buf+len; line = next) {
+    next = line + strcspn(line, "\r\n");
+    if (!*next) {
+      break;   /* an incomplete line */
+    }
+    *next++ = 0;
+    if (line == buf) {
+      continue;  /* %!PS-Adobe-x.y */
+    }
+    if (line[0] != '%' || iscomment(line, "%%EndComments")) {
+      break;
+    }
+    if (iscomment(line, "%%DocumentMedia:") || (media && iscomment(line, "%%+"))) {
+      media = 1;
+      line += iscomment(line, "%%+") ? 3 : 16;
+      if (sscanf(line, "%255s %lf %lf", name, &x1, &y1) == 3) {
+	*w = x1 > *w ? x1 : *w;
+	*h = y1 > *h ? y1 : *h;
+	found = 1;
+      }
+      continue;
+    }
+    media = 0;
+    if (iscomment(line, "%%BoundingBox:")
+	&& sscanf(line+14, "%lf %lf %lf %lf", &x0, &y0, &x1, &y1) == 4) {
+      *w = x1 > *w ? x1 : *w;
+      *h = y1 > *h ? y1 : *h;
+      found = 1;
+    }
+  }
+  return found ? 0 : -1;
+}
@@ -0,0 +1,31 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef DSC_H
+#define DSC_H
+
+#include <stdio.h>
+
+/* the page structure of a document that follows the document
+   structuring conventions. The header (prolog and setup) extends up
+   to pageptr[0], page p extends from pageptr[p] to pageptr[p+1], and
+   the trailer extends from pageptr[pages] to the end of the file. */
+struct dsc_s {
+  int pages;         /* number of pages */
+  long *pageptr;     /* pages+1 file offsets */
+  long end;          /* length of the file */
+};
+typedef struct dsc_s dsc_t;
+
+#define DSC_HEADER 16384  /* the most of a header that dsc_media reads */
+
+dsc_t *dsc_scan(FILE *f);
+void dsc_free(dsc_t *dsc);
+int dsc_write_range(int fd, dsc_t *dsc, int a, int b, int out);
+int dsc_write_pages(int fd, dsc_t *dsc, int *page, int count, int out);
+int dsc_boxes(int fd, dsc_t *dsc, double *boxes, double *docbox);
+int dsc_media(int fd, double *w, double *h);
+
+#endif /* DSC_H */
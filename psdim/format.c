@@ -20,14 +20,17 @@
 
 #define INFTY 10000
 
-int format(info_t info, int n, bbox_t *bboxes) {
+/* calculate the placement tr[0..n-1] of the n page sets with the
+   given bounding boxes on the output page, according to info, and
+   return its scaling factor */
+
+double format_layout(info_t info, int n, bbox_t *bboxes, transform_t *tr) {
   int xmin[info.cols], xmax[info.cols], dxmax[info.cols];
   int ymin[info.rows], ymax[info.rows], dymax[info.rows];
   int xmint, xmaxt, dxmaxt, dxmaxt2, dxmaxs, dxmaxs2;
   int ymint, ymaxt, dymaxt, dymaxt2, dymaxs, dymaxs2;
   double xoff[info.cols+1], yoff[info.rows+1];
   int totalw, totalh;
-  transform_t tr[n];
 
   bbox_t *b;
   int i,j,k;
@@ -341,7 +344,13 @@ int format(info_t info, int n, bbox_t *bboxes) {
     }
   }
 
-  /* output the results in order */
+  return sf;
+}
+
+/* output the placement tr[0..n-1] as a pstops page specification */
+
+void format_print(info_t info, int n, transform_t *tr) {
+  int k;
 
   printf("%d:", n);
   for (k=0; k<n; k++) {
@@ -352,6 +361,15 @@ int format(info_t info, int n, bbox_t *bboxes) {
     }
   }
   printf("\n");
+}
+
+/* calculate and output the best pstops page specification for the n
+   page sets with the given bounding boxes */
+
+int format(info_t info, int n, bbox_t *bboxes) {
+  transform_t tr[n];
 
+  format_layout(info, n, bboxes, tr);
+  format_print(info, n, tr);
   return 0;
 }			
@@ -21,6 +21,8 @@ struct transform_s {
 
 typedef struct transform_s transform_t;
 
+double format_layout(info_t info, int n, bbox_t *bboxes, transform_t *tr);
+void format_print(info_t info, int n, transform_t *tr);
 int format(info_t info, int n, bbox_t *bboxes);
 
 #endif /* FORMAT_H */
@@ -0,0 +1,252 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* measuring a document by the bounding boxes that it declares,
+   instead of rendering it. A PostScript document may give the box of
+   each page in a %%PageBoundingBox comment, and that of all pages in
+   its %%BoundingBox comment; a PDF document gives the CropBox of each
+   page. These are found by scanning the comments, or by asking
+   ghostscript for the page objects, neither of which paints
+   anything. Declared boxes are often wrong, though, so with
+   --geometry=auto a few pages are rendered as well, and if they
+   disagree with their boxes, the whole document is rendered. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "dsc.h"
+#include "jobs.h"
+#include "bbox.h"
+#include "geometry.h"
+
+/* read the CropBox of each of the pages of the PDF document path,
+   relative to the lower left corner of its MediaBox, into
+   boxes[4*p..4*p+3]. Return 0 on success, or 1 if the boxes cannot
+   be read or a page is rotated, so that they do not describe the
+   rendered page. */
+
+static int pdf_boxes(char *path, int pages, double *boxes) {
+  char *argv[GS_ARGS];
+  char *arg;
+  double rotate, media[4], crop[4];
+  FILE *f;
+  pid_t pid;
+  int p, k, i = 0, r = 0;
+
+  arg = (char *)malloc(strlen(path) + 16);
+  if (!arg) {
+    return 1;
+  }
+  sprintf(arg, "-sPDFname=%s", path);
+
+  argv[i++] = GS;
+  argv[i++] = "-q";
+  argv[i++] = "-dNODISPLAY";
+  argv[i++] = "-dNOSAFER";
+  argv[i++] = "-dBATCH";
+  argv[i++] = "-dNOPAUSE";
+  argv[i++] = arg;
+  argv[i++] = "-c";
+  /* per page: the rotation, the MediaBox, and the CropBox */
+  argv[i++] = "PDFname (r) file runpdfbegin { 1 1 pdfpagecount {"
+    " pdfgetpage dup /Rotate pget not { 0 } if ="
+    " dup /MediaBox pget not { [0 0 612 792] } if dup { = } forall"
+    " exch /CropBox pget { exch pop } if { = } forall } for }"
+    " stopped pop quit";
+  argv[i] = NULL;
+
+  f = gs_open(argv, -1, 1, &pid);
+  free(arg);
+  if (!f) {
+    return 1;
+  }
+  for (p=0; p<pages && r == 0; p++) {
+    if (fscanf(f, "%lf %lf %lf %lf %lf %lf %lf %lf %lf", &rotate,
+	       &media[0], &media[1], &media[2], &media[3],
+	       &crop[0], &crop[1], &crop[2], &crop[3]) != 9
+	|| fmod(rotate, 360.0) != 0.0) {
+      r = 1;
+      break;
+    }
+    /* either pair of corners may come first */
+    media[0] = media[0] < media[2] ? media[0] : media[2];
+    media[1] = media[1] < media[3] ? media[1] : media[3];
+    for (k=0; k<2; k++) {
+      boxes[4*p+k] = (crop[k] < crop[k+2] ? crop[k] : crop[k+2]) - media[k];
+      boxes[4*p+k+2] = (crop[k] < crop[k+2] ? crop[k+2] : crop[k]) - media[k];
+    }
+  }
+  if (gs_close(f, pid)) {
+    r = 1;
+  }
+  return r;
+}
+
+/* read the declared box of each of the doc->pages pages of doc into
+   boxes[4*p..4*p+3]. A PostScript page without a %%PageBoundingBox
+   comment gets the document's %%BoundingBox. Return 0 on success, 1
+   if some page has no box, or -1 with merrno set. */
+
+static int declared_boxes(doc_t *doc, double *boxes) {
+  double docbox[4];
+  int p;
+
+  if (doc->pdf) {
+    return doc->pages > 0 ? pdf_boxes(doc->path, doc->pages, boxes) : 1;
+  }
+  if (dsc_boxes(doc->fd, doc->dsc, boxes, docbox)) {
+    return -1;
+  }
+  for (p=0; p<doc->pages; p++) {
+    if (boxes[4*p] == HUGE_VAL) {
+      if (docbox[0] == HUGE_VAL) {
+	return 1;
+      }
+      memcpy(boxes + 4*p, docbox, sizeof(docbox));
+    }
+  }
+  if (doc->pages == 0) {
+    /* the whole document is one page, e.g., an EPS file */
+    if (docbox[0] == HUGE_VAL) {
+      return 1;
+    }
+    memcpy(boxes, docbox, sizeof(docbox));
+  }
+  return 0;
+}
+
+/* set b to the bounding box of the marks inside the declared box of
+   a page, as bbox_fold rounds it */
+static void declared_bbox(bbox_t *b, double *box) {
+  b->x0 = info.canvas_w;
+  b->y0 = info.canvas_h;
+  b->x1 = 0;
+  b->y1 = 0;
+  bbox_fold(b, box[0], box[1], box[2], box[3], info.canvas_w, info.canvas_h);
+}
+
+/* render the first, middle and last pages of doc, and compare them
+   with their declared boxes. Return 0 if they agree to within
+   GEOMETRY_SLACK points, 1 if not, or -1 with merrno set. */
+
+static int spot_check(doc_t *doc, double *boxes) {
+  int page[GEOMETRY_CHECK];
+  bbox_t rendered[GEOMETRY_CHECK];
+  percentile_t exact = { 0.0, 1.0, 0.0, 1.0 };
+  bbox_t b;
+  hist_t *s;
+  int i, count, r;
+
+  count = 0;
+  for (i=0; i<GEOMETRY_CHECK; i++) {
+    r = GEOMETRY_CHECK > 1 ? (int)((long)i*(doc->pages-1)/(GEOMETRY_CHECK-1)) : 0;
+    if (count == 0 || r != page[count-1]) {
+      page[count++] = r;
+    }
+  }
+  s = hist_canvas(count, info.color);
+  if (!s) {
+    return -1;
+  }
+  s->exact = !info.color;
+  r = render_pages(doc, page, count, info.color, s);
+  progress_done();
+  if (r < 0) {
+    hist_free(s);
+    return -1;
+  }
+  if (r != count) {
+    /* the page index is wrong */
+    hist_free(s);
+    return 1;
+  }
+  hist_bboxes(s, rendered, &exact);
+  hist_free(s);
+
+  for (i=0; i<count; i++) {
+    declared_bbox(&b, boxes + 4*page[i]);
+    if ((b.x0 >= b.x1) != (rendered[i].x0 >= rendered[i].x1)) {
+      return 1;
+    }
+    if (b.x0 < b.x1 &&
+	(abs(b.x0 - rendered[i].x0) > GEOMETRY_SLACK ||
+	 abs(b.x1 - rendered[i].x1) > GEOMETRY_SLACK ||
+	 abs(b.y0 - rendered[i].y0) > GEOMETRY_SLACK ||
+	 abs(b.y1 - rendered[i].y1) > GEOMETRY_SLACK)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* like psdim, but take the bounding box of each page from the box
+   that the document declares, as set by info.geometry, and ignore
+   percentiles. If some page declares no box, or the declared boxes
+   fail the spot check of --geometry=auto, the document is rendered
+   after all. Return 0 on success, or -1 with merrno set. */
+
+int psdim_geometry(char *infile, int n, bbox_t *bboxes) {
+  percentile_t exact = { 0.0, 1.0, 0.0, 1.0 };
+  doc_t doc;
+  double *boxes;
+  bbox_t b;
+  int p, j, r;
+
+  if (doc_open(infile, &doc)) {
+    return -1;
+  }
+  canvas_setup(doc.path);
+
+  boxes = (double *)malloc(4 * (doc.pages > 0 ? doc.pages : 1) * sizeof(double));
+  if (!boxes) {
+    doc_close(&doc);
+    merrno = ME_MEM;
+    return -1;
+  }
+  r = declared_boxes(&doc, boxes);
+  if (r == 1 && !info.quiet) {
+    fprintf(stderr, ""PSDIM": not all pages declare a bounding box; rendering the document.\n");
+  }
+  if (r == 0 && info.geometry == GEOMETRY_AUTO) {
+    r = doc.pages > 0 ? spot_check(&doc, boxes) : 1;
+    if (r == 1 && !info.quiet) {
+      fprintf(stderr, ""PSDIM": the declared bounding boxes disagree with the rendered pages;\n"
+	      "rendering the document.\n");
+    }
+  }
+
+  if (r == 0) {
+    for (j=0; j<n; j++) {
+      bboxes[j].x0 = info.canvas_w;
+      bboxes[j].y0 = info.canvas_h;
+      bboxes[j].x1 = 0;
+      bboxes[j].y1 = 0;
+    }
+    for (p=0; p < (doc.pages > 0 ? doc.pages : 1); p++) {
+      declared_bbox(&b, boxes + 4*p);
+      if (b.x0 < b.x1) {
+	bbox_fold(&bboxes[p % n], b.x0, b.y0, b.x1, b.y1, info.canvas_w, info.canvas_h);
+      }
+    }
+  } else if (r == 1) {
+    /* the document is still available under doc.path */
+    if (info.color) {
+      r = psdim_color(doc.path, n, bboxes, &exact);
+    } else {
+      r = psdim(doc.path, n, bboxes, &exact);
+    }
+  }
+  free(boxes);
+  doc_close(&doc);
+  return r;
+}
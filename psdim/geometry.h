@@ -0,0 +1,16 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "main.h"
+
+#define GEOMETRY_CHECK 3  /* pages that --geometry=auto renders */
+#define GEOMETRY_SLACK 3  /* points by which they may differ from their declared boxes */
+
+int psdim_geometry(char *infile, int n, bbox_t *bboxes);
+
+#endif /* GEOMETRY_H */
@@ -0,0 +1,549 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* rendering a document as several page ranges, in concurrent
+   ghostscript processes. Each worker process renders one range into
+   its own histogram and sends it back to the parent, which adds them
+   up. Since each page is still counted in the page set given by its
+   page number in the whole document, the result is the same as that
+   of a single ghostscript process. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "dsc.h"
+#include "jobs.h"
+#include "scan.h"
+#include "perpage.h"
+
+/* ---------------------------------------------------------------------- */
+/* auxiliary functions */
+
+/* write or read len bytes. Return 0 on success, or -1 on error or
+   end of file. */
+
+static int write_all(int fd, void *buf, size_t len) {
+  char *p = buf;
+  ssize_t r;
+
+  while (len > 0) {
+    r = write(fd, p, len);
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return -1;
+    }
+    p += r;
+    len -= r;
+  }
+  return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+  char *p = buf;
+  ssize_t r;
+
+  while (len > 0) {
+    r = read(fd, p, len);
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return -1;
+    }
+    p += r;
+    len -= r;
+  }
+  return 0;
+}
+
+/* copy standard input to a temporary file, and return its name in
+   *path. Return an open file descriptor, or -1 with merrno set. */
+
+int spool_stdin(char **path) {
+  char *tmpdir, *name;
+  char buf[BUFSIZ];
+  ssize_t r;
+  int fd;
+
+  tmpdir = getenv("TMPDIR");
+  if (!tmpdir || !*tmpdir) {
+    tmpdir = "/tmp";
+  }
+  name = (char *)malloc(strlen(tmpdir) + 16);
+  if (!name) {
+    merrno = ME_MEM;
+    return -1;
+  }
+  sprintf(name, "%s/psdimXXXXXX", tmpdir);
+  fd = mkstemp(name);
+  if (fd == -1) {
+    free(name);
+    merrno = ME_IO;
+    return -1;
+  }
+  while ((r = read(0, buf, BUFSIZ)) != 0) {
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    if (r == -1 || write_all(fd, buf, r)) {
+      close(fd);
+      unlink(name);
+      free(name);
+      merrno = ME_IO;
+      return -1;
+    }
+  }
+  *path = name;
+  return fd;
+}
+
+/* ask ghostscript for the number of pages of a PDF file, and for the
+   largest width and height of its pages (in points, taking /Rotate
+   into account), which are stored in *w and *h, or 0 if unknown.
+   Return the number of pages, or 0 if this cannot be determined. The
+   answer for the last file asked about is remembered. */
+
+int pdf_info(char *path, double *w, double *h) {
+  static char *last = NULL;
+  static int last_pages;
+  static double last_w, last_h;
+  char *argv[GS_ARGS];
+  char *arg;
+  FILE *f;
+  pid_t pid;
+  int pages, i = 0;
+
+  if (last && strcmp(last, path) == 0) {
+    *w = last_w;
+    *h = last_h;
+    return last_pages;
+  }
+  *w = *h = 0.0;
+  arg = (char *)malloc(strlen(path) + 16);
+  if (!arg) {
+    return 0;
+  }
+  sprintf(arg, "-sPDFname=%s", path);
+
+  argv[i++] = GS;
+  argv[i++] = "-q";
+  argv[i++] = "-dNODISPLAY";
+  argv[i++] = "-dNOSAFER";
+  argv[i++] = "-dBATCH";
+  argv[i++] = "-dNOPAUSE";
+  argv[i++] = arg;
+  argv[i++] = "-c";
+  argv[i++] = "PDFname (r) file runpdfbegin pdfpagecount = /W 0 def /H 0 def"
+    " { 1 1 pdfpagecount { pdfgetpage dup /MediaBox pget {"
+    " aload pop 3 -1 roll sub abs 3 1 roll exch sub abs exch"
+    " 3 -1 roll /Rotate pget { 90 idiv 2 mod 0 ne { exch } if } if"
+    " dup H gt { /H exch def } { pop } ifelse"
+    " dup W gt { /W exch def } { pop } ifelse } { pop } ifelse } for }"
+    " stopped pop W = H = quit";
+  argv[i] = NULL;
+
+  f = gs_open(argv, -1, 1, &pid);
+  free(arg);
+  if (!f) {
+    return 0;
+  }
+  if (fscanf(f, "%d", &pages) != 1 || pages < 0) {
+    pages = 0;
+  } else if (fscanf(f, "%lf %lf", w, h) != 2 || *w < 0.0 || *h < 0.0) {
+    *w = *h = 0.0;
+  }
+  gs_close(f, pid);
+
+  free(last);
+  last = strdup(path);
+  last_pages = pages;
+  last_w = *w;
+  last_h = *h;
+  return pages;
+}
+
+/* ---------------------------------------------------------------------- */
+/* documents */
+
+/* prepare the document infile (or stdin, if infile is NULL) for
+   rendering by page ranges. Standard input is copied to a temporary
+   file first. Return 0 on success, or -1 with merrno set. */
+
+int doc_open(char *infile, doc_t *doc) {
+  struct stat st;
+  double w, h;
+  FILE *f;
+
+  doc->tmppath = NULL;
+  doc->pdf = 0;
+  doc->pages = 0;
+  doc->dsc = NULL;
+
+  if (infile) {
+    doc->path = infile;
+    doc->fd = open(infile, O_RDONLY);
+    if (doc->fd == -1) {
+      merrno = ME_IO;
+      return -1;
+    }
+    /* check that it's not a directory */
+    fstat(doc->fd, &st);
+    if (S_ISDIR(st.st_mode)) {
+      close(doc->fd);
+      errno = EISDIR;
+      merrno = ME_IO;
+      return -1;
+    }
+  } else {
+    doc->fd = spool_stdin(&doc->tmppath);
+    if (doc->fd == -1) {
+      return -1;
+    }
+    doc->path = doc->tmppath;
+  }
+
+  if (is_pdf(doc->fd)) {
+    doc->pdf = 1;
+    doc->pages = pdf_info(doc->path, &w, &h);
+    return 0;
+  }
+
+  f = fdopen(dup(doc->fd), "r");
+  if (!f) {
+    doc_close(doc);
+    merrno = ME_IO;
+    return -1;
+  }
+  doc->dsc = dsc_scan(f);
+  fclose(f);
+  if (!doc->dsc) {
+    doc_close(doc);
+    return -1;
+  }
+  doc->pages = doc->dsc->pages;
+  return 0;
+}
+
+void doc_close(doc_t *doc) {
+  close(doc->fd);
+  dsc_free(doc->dsc);
+  doc->dsc = NULL;
+  if (doc->tmppath) {
+    unlink(doc->tmppath);
+    free(doc->tmppath);
+    doc->tmppath = NULL;
+  }
+}
+
+/* render pages of the document in a single ghostscript process, and
+   add them to hist. If page is NULL, render pages a..b-1 (counting
+   from 0), or the whole document if b is -1; the pages are counted
+   in the page sets given by their page numbers. Otherwise, render
+   the count pages page[0..count-1], and count them in page sets 0, 1,
+   2, ... in this order. If win is not NULL, only render that window
+   of the canvas. Return the number of pages rendered, or -1 with
+   merrno set. */
+
+static int render_doc(doc_t *doc, int a, int b, int *page, int count,
+		      int color, window_t *win, hist_t *hist) {
+  char *argv[GS_ARGS];
+  char first[32], last[32];
+  char *pagelist = NULL;
+  int argc, fd[2], r, fdin, i;
+  pid_t feeder = -1;
+
+  argc = gs_args(argv, color);
+  if (win) {
+    argc = gs_window(argv, argc, win);
+  }
+  if (!win || win->pagesize) {
+    argc = gs_pagesize(argv, argc);
+  }
+
+  if (doc->pdf) {
+    /* ghostscript needs to seek in PDF files, so pass it by name */
+    argc--;
+    if (page) {
+      pagelist = (char *)malloc(count*12 + 16);
+      if (!pagelist) {
+	merrno = ME_MEM;
+	return -1;
+      }
+      strcpy(pagelist, "-sPageList=");
+      for (i=0; i<count; i++) {
+	sprintf(pagelist + strlen(pagelist), i ? ",%d" : "%d", page[i]+1);
+      }
+      argv[argc++] = pagelist;
+    } else if (b != -1) {
+      sprintf(first, "-dFirstPage=%d", a+1);
+      sprintf(last, "-dLastPage=%d", b);
+      argv[argc++] = first;
+      argv[argc++] = last;
+    }
+    argv[argc++] = "-dBATCH";
+    argv[argc++] = doc->path;
+    argv[argc] = NULL;
+    fdin = -1;
+  } else if (!page && b == -1) {
+    lseek(doc->fd, 0L, SEEK_SET);
+    fdin = dup(doc->fd);
+    if (fdin == -1) {
+      merrno = ME_IO;
+      return -1;
+    }
+  } else {
+    /* a separate process feeds the pages to ghostscript */
+    if (pipe(fd) == -1) {
+      merrno = ME_IO;
+      return -1;
+    }
+    feeder = fork();
+    if (feeder == -1) {
+      close(fd[0]);
+      close(fd[1]);
+      merrno = ME_IO;
+      return -1;
+    }
+    if (feeder == 0) {
+      close(fd[0]);
+      if (page) {
+	dsc_write_pages(doc->fd, doc->dsc, page, count, fd[1]);
+      } else {
+	dsc_write_range(doc->fd, doc->dsc, a, b, fd[1]);
+      }
+      _exit(0);
+    }
+    close(fd[1]);
+    fdin = fd[0];
+  }
+
+  r = gs_render(argv, fdin, hist, page || b == -1 ? 0 : a);
+  free(pagelist);
+  if (feeder != -1) {
+    waitpid(feeder, NULL, 0);
+  }
+  return r;
+}
+
+/* render pages a..b-1 of the document (counting from 0) in a single
+   ghostscript process, and add them to hist. If b is -1, render the
+   whole document. If win is not NULL, only render that window of the
+   canvas. Return the number of pages rendered, or -1 with merrno
+   set. */
+
+int render_range(doc_t *doc, int a, int b, int color, window_t *win, hist_t *hist) {
+  return render_doc(doc, a, b, NULL, 0, color, win, hist);
+}
+
+/* render the count pages page[0..count-1] of the document (counting
+   from 0) in a single ghostscript process, and add them to page sets
+   0, 1, 2, ... of hist, in this order. Return the number of pages
+   rendered, or -1 with merrno set. */
+
+int render_pages(doc_t *doc, int *page, int count, int color, hist_t *hist) {
+  return render_doc(doc, 0, 0, page, count, color, NULL, hist);
+}
+
+/* ---------------------------------------------------------------------- */
+/* concurrent workers */
+
+/* start a worker process that renders pages a..b-1 of doc (or all
+   of it, if b is -1) on a canvas of the size of hist. It sends back
+   the number of pages rendered (or -merrno on error), followed by
+   its histogram. Return 0 on success, or -1 with merrno set. */
+
+int start_worker(doc_t *doc, int a, int b, int color, hist_t *hist, worker_t *w) {
+  int fd[2];
+  int r, k;
+  hist_t *h;
+  pagestat_t *st;
+
+  if (pipe(fd) == -1) {
+    merrno = ME_IO;
+    return -1;
+  }
+  w->a = a;
+  w->b = b;
+  w->pid = fork();
+  if (w->pid == -1) {
+    close(fd[0]);
+    close(fd[1]);
+    merrno = ME_IO;
+    return -1;
+  }
+  if (w->pid == 0) {
+    /* child */
+    close(fd[0]);
+    info.quiet = 1;
+    info.canvas_w = (int)ceil(hist->w * 72.0 / hist->res);
+    info.canvas_h = (int)ceil(hist->h * 72.0 / hist->res);
+    perpage_buffer();
+    h = hist_new(hist->n, hist->w, hist->h);
+    if (h) {
+      h->perpage = hist->perpage;
+      h->exact = hist->exact;
+      h->res = hist->res;
+      h->gray = hist->gray;
+      h->threshold = hist->threshold;
+    }
+    r = h ? render_range(doc, a, b, color, NULL, h) : -1;
+    if (r < 0) {
+      r = -merrno;
+    }
+    write_all(fd[1], &r, sizeof(int));
+    if (r >= 0) {
+      write_all(fd[1], h->rowcount, (size_t)h->n*h->h*sizeof(long long));
+      write_all(fd[1], h->colcount, (size_t)h->n*h->w*sizeof(long long));
+      write_all(fd[1], h->rowmax, (size_t)h->n*h->h);
+      write_all(fd[1], h->colmax, (size_t)h->n*h->w);
+      write_all(fd[1], &h->anchor, sizeof(int));
+      k = perpage_buffered(&st);
+      write_all(fd[1], &k, sizeof(int));
+      write_all(fd[1], st, (size_t)k*sizeof(pagestat_t));
+    }
+    _exit(0);
+  }
+  close(fd[1]);
+  w->fd = fd[0];
+  return 0;
+}
+
+/* collect the result of a worker and add it to hist. If emit is
+   set, also write the worker's per-page records, provided it rendered
+   the pages it was meant to. Return the number of pages rendered, or
+   -1 with merrno set. */
+
+int finish_worker(worker_t *w, hist_t *hist, hist_t *tmp, int emit) {
+  int r, k;
+  pagestat_t st;
+
+  if (read_all(w->fd, &r, sizeof(int))) {
+    r = -ME_EOF;
+  } else if (r >= 0) {
+    if (read_all(w->fd, tmp->rowcount, (size_t)tmp->n*tmp->h*sizeof(long long))
+	|| read_all(w->fd, tmp->colcount, (size_t)tmp->n*tmp->w*sizeof(long long))
+	|| read_all(w->fd, tmp->rowmax, (size_t)tmp->n*tmp->h)
+	|| read_all(w->fd, tmp->colmax, (size_t)tmp->n*tmp->w)
+	|| read_all(w->fd, &tmp->anchor, sizeof(int))
+	|| read_all(w->fd, &k, sizeof(int))) {
+      r = -ME_EOF;
+    } else {
+      hist_merge(hist, tmp);
+      /* pages that reported their size were already moved */
+      if (!tmp->anchor) {
+	hist->anchor = 0;
+      }
+      emit = emit && r == w->b - w->a;
+      while (k-- > 0) {
+	if (read_all(w->fd, &st, sizeof(pagestat_t))) {
+	  r = -ME_EOF;
+	  break;
+	}
+	if (emit) {
+	  perpage_page(&st);
+	}
+      }
+    }
+  }
+  close(w->fd);
+  waitpid(w->pid, NULL, 0);
+  if (r < 0) {
+    merrno = -r;
+    return -1;
+  }
+  return r;
+}
+
+/* render the document infile (or stdin, if infile is NULL) in up to
+   jobs concurrent ghostscript processes, and add its pages to
+   hist. Documents whose pages cannot be located are rendered in a
+   single process. Return 0 on success, or -1 with merrno set. */
+
+int psdim_jobs(char *infile, int jobs, int color, hist_t *hist) {
+  doc_t doc;
+  worker_t *w;
+  hist_t *tmp;
+  int i, k, r, started, mismatch;
+
+  if (doc_open(infile, &doc)) {
+    return -1;
+  }
+  if (jobs > doc.pages) {
+    jobs = doc.pages;
+  }
+  if (jobs < 2) {
+    r = render_range(&doc, 0, -1, color, NULL, hist);
+    progress_done();
+    doc_close(&doc);
+    return r < 0 ? -1 : 0;
+  }
+
+  w = (worker_t *)malloc(jobs * sizeof(worker_t));
+  tmp = hist_new(hist->n, hist->w, hist->h);
+  if (!w || !tmp) {
+    free(w);
+    hist_free(tmp);
+    doc_close(&doc);
+    merrno = ME_MEM;
+    return -1;
+  }
+
+  /* split the document into jobs ranges of nearly equal length */
+  r = 0;
+  for (started=0; started<jobs; started++) {
+    if (start_worker(&doc, (long)started*doc.pages/jobs,
+		     (long)(started+1)*doc.pages/jobs, color, hist, &w[started])) {
+      r = -1;
+      break;
+    }
+  }
+
+  /* collect the results in order */
+  mismatch = 0;
+  for (k=0; k<started; k++) {
+    hist_clear(tmp);
+    i = finish_worker(&w[k], hist, tmp, r == 0 && !mismatch);
+    if (i < 0) {
+      r = -1;
+    } else if (i != w[k].b - w[k].a) {
+      mismatch = 1;
+    } else {
+      for (i=w[k].a; i<w[k].b; i++) {
+	progress_page(i+1);
+      }
+    }
+  }
+  progress_done();
+
+  /* if the page ranges did not come out as expected (e.g., because
+     the document's page comments are wrong), start over with a
+     single process */
+  if (r == 0 && mismatch) {
+    hist_clear(hist);
+    r = render_range(&doc, 0, -1, color, NULL, hist) < 0 ? -1 : 0;
+    progress_done();
+  }
+
+  free(w);
+  hist_free(tmp);
+  doc_close(&doc);
+  return r;
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "psdim.h"
+#include "dsc.h"
+
+/* a document that has been prepared for rendering by page ranges */
+struct doc_s {
+  char *path;        /* file name of the document */
+  char *tmppath;     /* name of a spooled copy of stdin, or NULL */
+  int fd;            /* file descriptor open on path */
+  int pdf;           /* is this a PDF document? */
+  int pages;         /* number of pages, or 0 if unknown */
+  dsc_t *dsc;        /* page structure of a PostScript document */
+};
+typedef struct doc_s doc_t;
+
+/* a worker process, rendering a page range of a document */
+struct worker_s {
+  pid_t pid;     /* process id of the worker */
+  int fd;        /* pipe on which the worker sends its result */
+  int a, b;      /* page range */
+};
+typedef struct worker_s worker_t;
+
+int spool_stdin(char **path);
+int pdf_info(char *path, double *w, double *h);
+int doc_open(char *infile, doc_t *doc);
+void doc_close(doc_t *doc);
+int render_range(doc_t *doc, int a, int b, int color, window_t *win, hist_t *hist);
+int render_pages(doc_t *doc, int *page, int count, int color, hist_t *hist);
+int start_worker(doc_t *doc, int a, int b, int color, hist_t *hist, worker_t *w);
+int finish_worker(worker_t *w, hist_t *hist, hist_t *tmp, int emit);
+int psdim_jobs(char *infile, int jobs, int color, hist_t *hist);
+
+#endif /* JOBS_H */
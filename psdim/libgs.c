@@ -0,0 +1,204 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* rendering in-process with the ghostscript library. Ghostscript
+   renders each page into a buffer of the display device, which is
+   passed directly to the histogram kernels; there is no ghostscript
+   process, no pipe, and no PNM stream to parse. This is only
+   compiled if configure was run with --with-libgs. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#ifdef HAVE_LIBGS
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ghostscript/iapi.h>
+#include <ghostscript/gdevdsp.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "libgs.h"
+
+/* return codes of gsapi_init_with_args, from ghostscript's ierrors.h */
+#define GS_FATAL -100  /* the interpreter could not run */
+#define GS_QUIT  -101  /* it quit normally */
+
+/* the state of a rendering, passed to the callbacks as their handle */
+struct render_s {
+  hist_t *hist;          /* where to count the ink */
+  int color;             /* one of COLOR_* */
+  int pages;             /* pages rendered so far */
+  int err;               /* merrno of the first error, or 0 */
+  unsigned char *image;  /* the device's page buffer */
+  int w, h;              /* its size in pixels */
+  int raster;            /* its bytes per row */
+};
+typedef struct render_s render_t;
+
+/* ---------------------------------------------------------------------- */
+/* standard streams: input comes from stdin as usual, but messages go
+   to stderr, so that they are not mixed up with psdim's output */
+
+static int gsdll_stdin(void *handle, char *buf, int len) {
+  return read(0, buf, len);
+}
+
+static int gsdll_stderr(void *handle, const char *str, int len) {
+  return fwrite(str, 1, len, stderr);
+}
+
+/* standard error, along with the reports of the page size prelude */
+static int gsdll_side(void *handle, const char *str, int len) {
+  render_t *r = (render_t *)handle;
+
+  if (side_write(str, len)) {
+    r->err = merrno;
+    return -1;
+  }
+  return len;
+}
+
+/* ---------------------------------------------------------------------- */
+/* display device callbacks */
+
+static int display_noop(void *handle, void *device) {
+  return 0;
+}
+
+static int display_presize(void *handle, void *device, int width, int height,
+			   int raster, unsigned int format) {
+  return 0;
+}
+
+static int display_size(void *handle, void *device, int width, int height,
+			int raster, unsigned int format, unsigned char *pimage) {
+  render_t *r = (render_t *)handle;
+
+  r->image = pimage;
+  r->w = width;
+  r->h = height;
+  r->raster = raster;
+  return 0;
+}
+
+static int display_page(void *handle, void *device, int copies, int flush) {
+  render_t *r = (render_t *)handle;
+  pnmpage_t pg;
+
+  /* the buffer, as hist_page expects a page read from a pipe */
+  pg.w = r->w;
+  pg.h = r->h;
+  pg.bpp = r->color == COLOR_RGB ? 3 : r->color == COLOR_GRAY || r->hist->gray ? 1 : 0;
+  pg.bpr = r->raster;
+  pg.size = (size_t)r->raster * r->h;
+  pg.data = r->image;
+  pg.datalen = pg.size;
+  pg.sized = side_pagesize(&pg.height) == 0;
+  if (hist_page(r->hist, r->pages, &pg)) {
+    r->err = merrno;
+    return -1;
+  }
+  r->pages++;
+  return 0;
+}
+
+static int display_update(void *handle, void *device, int x, int y, int w, int h) {
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* render the document infile (or stdin, if infile is NULL) with the
+   ghostscript library, and add its pages to hist. Like render(),
+   errors in the document are reported by ghostscript, but otherwise
+   ignored. Return 0 on success, or -1 with merrno set. */
+
+int render_libgs(char *infile, int color, hist_t *hist) {
+  void *instance;
+  display_callback callback;
+  render_t r;
+  char format[40];
+  char geom[32], res[16];
+  char *argv[GS_ARGS];
+  int argc, code;
+
+  memset(&callback, 0, sizeof(callback));
+  callback.size = sizeof(callback);
+  callback.version_major = DISPLAY_VERSION_MAJOR;
+  callback.version_minor = DISPLAY_VERSION_MINOR;
+  callback.display_open = display_noop;
+  callback.display_preclose = display_noop;
+  callback.display_close = display_noop;
+  callback.display_presize = display_presize;
+  callback.display_size = display_size;
+  callback.display_sync = display_noop;
+  callback.display_page = display_page;
+  callback.display_update = display_update;
+
+  /* the same bitmap (1 = black), 8-bit graymap or 8-bit RGB pixmap
+     as pbmraw, pgmraw and ppmraw produce, top row first */
+  sprintf(format, "-dDisplayFormat=%d", DISPLAY_BIGENDIAN | DISPLAY_TOPFIRST
+	  | (color == COLOR_RGB ? DISPLAY_COLORS_RGB | DISPLAY_ALPHA_NONE | DISPLAY_DEPTH_8
+	     : color == COLOR_GRAY || hist->gray ? DISPLAY_COLORS_GRAY | DISPLAY_ALPHA_NONE | DISPLAY_DEPTH_8
+	     : DISPLAY_COLORS_NATIVE | DISPLAY_DEPTH_1));
+
+  argc = 0;
+  argv[argc++] = PSDIM;
+  argv[argc++] = "-q";
+  argv[argc++] = "-dNOPAUSE";
+  argv[argc++] = "-dBATCH";
+  argv[argc++] = "-sDEVICE=display";
+  sprintf(res, "-r%d", hist->res);
+  argv[argc++] = res;
+  if (hist->gray) {
+    argv[argc++] = "-dGraphicsAlphaBits=4";
+    argv[argc++] = "-dTextAlphaBits=4";
+  }
+  sprintf(geom, "-g%dx%d", hist->w, hist->h);
+  argv[argc++] = geom;
+  argv[argc++] = format;
+  argv[argc++] = "-";
+  argv[argc] = NULL;
+  argc = gs_fast(argv, argc);
+  argc = gs_pagesize(argv, argc);
+  if (gs_input(argv, argc, infile)) {
+    return -1;
+  }
+
+  memset(&r, 0, sizeof(r));
+  r.hist = hist;
+  r.color = color;
+
+  if (gsapi_new_instance(&instance, &r) < 0) {
+    merrno = ME_GSNOTFOUND;
+    return -1;
+  }
+  gsapi_set_stdio(instance, gsdll_stdin, gsdll_stderr, gsdll_side);
+  gsapi_set_display_callback(instance, &callback);
+  side_open(-1);
+  code = gsapi_init_with_args(instance, argc, argv);
+  gsapi_exit(instance);
+  gsapi_delete_instance(instance);
+  side_close();
+  progress_done();
+
+  if (r.err) {
+    merrno = r.err;
+    return -1;
+  }
+  /* errors after the first page are those of the document, and are
+     ignored as in render(); before it, nothing was measured */
+  if (code < 0 && code != GS_QUIT && r.pages == 0) {
+    merrno = code <= GS_FATAL ? ME_GSNOTFOUND : ME_POSTSCRIPT;
+    return -1;
+  }
+  return 0;
+}
+
+#endif /* HAVE_LIBGS */
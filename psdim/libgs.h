@@ -0,0 +1,13 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef LIBGS_H
+#define LIBGS_H
+
+#include "psdim.h"
+
+int render_libgs(char *infile, int color, hist_t *hist);
+
+#endif /* LIBGS_H */
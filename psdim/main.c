@@ -22,11 +22,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 #include <getopt.h>
 
 #include "main.h"
 #include "psdim.h"
 #include "format.h"
+#include "cache.h"
+#include "perpage.h"
+#include "raster.h"
+#include "serve.h"
+#include "batch.h"
+#include "auto.h"
+#include "geometry.h"
 
 info_t info;
 
@@ -41,6 +49,8 @@ char *mstrerror[] = {
   /* 3 */    "Unexpected end of file from ghostscript",
   /* 4 */    "Postscript error",
   /* 5 */    "I/O error",  /* errno will be set */
+  /* 6 */    "Invalid or truncated raster input",
+  /* 7 */    "Invalid histogram file, or one for a different layout",
 };
 
 /* dimensions of the various page formats, in postscript points */
@@ -65,6 +75,38 @@ pageformat_t pageformat[] = {
 #define MASK_BOTTOM 0x4
 #define MASK_TOP    0x8
 
+/* codes for long options without a short equivalent */
+#define OPT_ENGINE  256
+#define OPT_SAMPLE  257
+#define OPT_SAMPLE_FRACTION 258
+#define OPT_SAMPLE_ESCALATE 259
+#define OPT_CACHE   260
+#define OPT_CACHE_DIR 261
+#define OPT_CACHE_SIZE 262
+#define OPT_PER_PAGE 263
+#define OPT_PER_PAGE_FORMAT 264
+#define OPT_CANVAS  265
+#define OPT_PIPELINE 266
+#define OPT_TRANSPORT 267
+#define OPT_RASTER  268
+#define OPT_RESOLUTION 269
+#define OPT_SERVE   270
+#define OPT_SERVE_JOBS 271
+#define OPT_SERVE_RECYCLE 272
+#define OPT_BATCH   273
+#define OPT_COMMON_LAYOUT 274
+#define OPT_FUDGES        275
+#define OPT_SAVE_HIST     276
+#define OPT_LOAD_HIST     277
+#define OPT_AUTO          278
+#define OPT_AUTO_TOP      279
+#define OPT_FAST_IMAGES   280
+#define OPT_FAST_TEXT     281
+#define OPT_VALIDATE      282
+#define OPT_GRAY          283
+#define OPT_GEOMETRY      284
+#define OPT_PER_PAGE_FD   285
+
 int license(FILE *f) {
   fprintf(f, 
 "This program is free software; you can redistribute it and/or modify\n"
@@ -115,13 +157,44 @@ int usage(FILE *f) {
   fprintf(f, " -d, --righttoleft        - page numbers increase right to left\n");
   fprintf(f, " -e, --bottomtotop        - page numbers increase bottom to top\n");
   fprintf(f, " -C, --color              - handle non-white backgrounds\n");
+  fprintf(f, "     --gray[=<n>]         - like --color, with graymaps and a tolerance of n levels\n");
   fprintf(f, " -i, --clip               - output page clipping instructions for pstops-clip\n");
   fprintf(f, " -F, --fudge [L|R|T|B]<n> - percentage of pixels allowed out of bounds\n");
+  fprintf(f, "     --fudges <list>      - output a page format for each fudge in the list\n");
+  fprintf(f, "     --save-hist <file>   - save the pixel counts to file\n");
+  fprintf(f, "     --load-hist <file>   - measure pixel counts saved with --save-hist\n");
+  fprintf(f, "     --auto[=<n>]         - find the layout with the largest scale, up to n-up\n");
+  fprintf(f, "     --auto-top <k>       - with --auto, list the k best layouts\n");
   fprintf(f, " -H, --ladjust <dim>      - adjust left edge of input's bounding box\n");
   fprintf(f, " -I, --radjust <dim>      - adjust right edge of input's bounding box\n");
   fprintf(f, " -J, --tadjust <dim>      - adjust top edge of input's bounding box\n");
   fprintf(f, " -K, --badjust <dim>      - adjust bottom edge of input's bounding box\n");
   fprintf(f, " -S, --shrink             - only shrink, never enlarge page\n");
+  fprintf(f, " -j, --jobs <n>           - render with n concurrent ghostscript processes\n");
+  fprintf(f, "     --engine <name>      - measuring engine: raster, bbox, auto, adaptive\n");
+  fprintf(f, "     --geometry <name>    - trust declared bounding boxes: render, dsc, auto\n");
+  fprintf(f, "     --fast-images        - paint images as solid rectangles\n");
+  fprintf(f, "     --fast-text          - paint text as solid rectangles\n");
+  fprintf(f, "     --validate           - compare --fast-images and --fast-text with a full rendering\n");
+  fprintf(f, "     --sample <k>         - only render k pages per page set\n");
+  fprintf(f, "     --sample-fraction <f> - only render a fraction f of the pages\n");
+  fprintf(f, "     --sample-escalate[=<dim>] - render all pages if the sample disagrees\n");
+  fprintf(f, "     --cache              - reuse results for unchanged documents\n");
+  fprintf(f, "     --cache-dir <dir>    - use dir for the result cache\n");
+  fprintf(f, "     --cache-size <n>     - limit the result cache to n kilobytes\n");
+  fprintf(f, "     --per-page <file>    - write the bounding box of each page to file\n");
+  fprintf(f, "     --per-page-fd <n>    - write the bounding box of each page to descriptor n\n");
+  fprintf(f, "     --per-page-format <f> - format of per-page records: tsv, json\n");
+  fprintf(f, "     --canvas <format>    - render on a canvas of this size (e.g. a4, 8inx10in)\n");
+  fprintf(f, "     --pipeline[=<n>]     - read pages in a separate thread, buffering n kilobytes\n");
+  fprintf(f, "     --transport <name>   - how pages get from ghostscript: pipe, shm\n");
+  fprintf(f, "     --raster <file>      - measure pre-rendered PBM/PGM/PPM pages, without ghostscript\n");
+  fprintf(f, "     --resolution <n>     - rendering resolution, or that of the raster pages, in dpi\n");
+  fprintf(f, "     --serve <socket>     - answer requests on a Unix domain socket\n");
+  fprintf(f, "     --serve-jobs <n>     - handle at most n requests at a time\n");
+  fprintf(f, "     --serve-recycle <n>  - restart each ghostscript after n requests\n");
+  fprintf(f, "     --batch              - measure each of several input files\n");
+  fprintf(f, "     --common-layout      - with --batch, one page format for all files\n");
   fprintf(f, " -1, --1up                - fit to size mode\n");
   fprintf(f, " -2, --2up                - 1x2 landscape mode\n");
   fprintf(f, " -4, --4up                - 2x2 portrait mode\n");
@@ -178,6 +251,80 @@ double parse_dimension(char *s, char **endptr) {
   return x;
 }
 
+/* parse the argument of -F, which is a percentage, preceded by the
+   letters of the edges it applies to (all edges if there are none),
+   and set the percentiles accordingly. Return 0 on success, or -1 if
+   it is invalid. */
+static int parse_fudge(char *s, percentile_t *percentile) {
+  double fudge;
+  int mask = 0;
+
+  while (1) {
+    if (*s == 'l' || *s == 'L') {
+      mask |= MASK_LEFT;
+    } else if (*s == 'r' || *s == 'R') {
+      mask |= MASK_RIGHT;
+    } else if (*s == 'b' || *s == 'B' || *s == 'd' || *s == 'D') {
+      mask |= MASK_BOTTOM;
+    } else if (*s == 't' || *s == 'T' || *s == 'u' || *s == 'U') {
+      mask |= MASK_TOP;
+    } else {
+      break;
+    }
+    s += 1;
+  }
+  fudge = strtod(s, &s);
+  if (*s || fudge < 0.0 || fudge > 100.0) {
+    return -1;
+  }
+  if (mask == 0 || mask & MASK_LEFT) {
+    percentile->x0 = fudge * 0.01;
+  }
+  if (mask == 0 || mask & MASK_RIGHT) {
+    percentile->x1 = 1.0 - fudge * 0.01;
+  }
+  if (mask == 0 || mask & MASK_BOTTOM) {
+    percentile->y0 = fudge * 0.01;
+  }
+  if (mask == 0 || mask & MASK_TOP) {
+    percentile->y1 = 1.0 - fudge * 0.01;
+  }
+  return 0;
+}
+
+/* parse the argument of --fudges, a comma separated list of fudges.
+   Each fudge is one or more arguments of -F, separated by "+", which
+   apply on top of the -F options. Store the percentiles of each in
+   info.fudges. Return 0 on success, or -1 if it is invalid. */
+static int parse_fudges(char *s) {
+  char *copy, *item, *part, *p, *q;
+  int count;
+
+  copy = strdup(s);
+  count = 1;
+  for (p=s; *p; p++) {
+    count += *p == ',';
+  }
+  info.fudges = (percentile_t *)malloc(count * sizeof(percentile_t));
+  if (!copy || !info.fudges) {
+    fprintf(stderr, ""PSDIM": Out of memory\n");
+    exit(1);
+  }
+  info.fudge_count = 0;
+  for (item = strtok_r(copy, ",", &p); item; item = strtok_r(NULL, ",", &p)) {
+    info.fudges[info.fudge_count] = info.percentile;
+    for (part = strtok_r(item, "+", &q); part; part = strtok_r(NULL, "+", &q)) {
+      if (parse_fudge(part, &info.fudges[info.fudge_count])) {
+	free(copy);
+	return -1;
+      }
+    }
+    info.fudge_count++;
+  }
+  free(copy);
+  return info.fudge_count > 0 ? 0 : -1;
+}
+
 static struct option longopts[] = {
   {"help",         0, 0, 'h'},
   {"version",      0, 0, 'v'},
@@ -207,9 +354,40 @@ static struct option longopts[] = {
   {"righttoleft",  0, 0, 'd'},
   {"bottomtotop",  0, 0, 'e'},
   {"color",        0, 0, 'C'},
+  {"gray",         2, 0, OPT_GRAY},
   {"clip",         0, 0, 'i'},
   {"fudge",        1, 0, 'F'},
+  {"fudges",       1, 0, OPT_FUDGES},
+  {"save-hist",    1, 0, OPT_SAVE_HIST},
+  {"load-hist",    1, 0, OPT_LOAD_HIST},
+  {"auto",         2, 0, OPT_AUTO},
+  {"auto-top",     1, 0, OPT_AUTO_TOP},
+  {"fast-images",  0, 0, OPT_FAST_IMAGES},
+  {"fast-text",    0, 0, OPT_FAST_TEXT},
+  {"validate",     0, 0, OPT_VALIDATE},
   {"shrink",       0, 0, 'S'},
+  {"jobs",         1, 0, 'j'},
+  {"engine",       1, 0, OPT_ENGINE},
+  {"geometry",     1, 0, OPT_GEOMETRY},
+  {"sample",       1, 0, OPT_SAMPLE},
+  {"sample-fraction", 1, 0, OPT_SAMPLE_FRACTION},
+  {"sample-escalate", 2, 0, OPT_SAMPLE_ESCALATE},
+  {"cache",        0, 0, OPT_CACHE},
+  {"cache-dir",    1, 0, OPT_CACHE_DIR},
+  {"cache-size",   1, 0, OPT_CACHE_SIZE},
+  {"per-page",     1, 0, OPT_PER_PAGE},
+  {"per-page-fd",  1, 0, OPT_PER_PAGE_FD},
+  {"per-page-format", 1, 0, OPT_PER_PAGE_FORMAT},
+  {"canvas",       1, 0, OPT_CANVAS},
+  {"pipeline",     2, 0, OPT_PIPELINE},
+  {"transport",    1, 0, OPT_TRANSPORT},
+  {"raster",       1, 0, OPT_RASTER},
+  {"resolution",   1, 0, OPT_RESOLUTION},
+  {"serve",        1, 0, OPT_SERVE},
+  {"serve-jobs",   1, 0, OPT_SERVE_JOBS},
+  {"serve-recycle", 1, 0, OPT_SERVE_RECYCLE},
+  {"batch",        0, 0, OPT_BATCH},
+  {"common-layout", 0, 0, OPT_COMMON_LAYOUT},
   {"1up",          0, 0, '1'},
   {"2up",          0, 0, '2'},
   {"4up",          0, 0, '4'},
@@ -219,13 +397,12 @@ static struct option longopts[] = {
   {0, 0, 0, 0}
 };
 
-static char *shortopts = "hvlqx:y:p:m:n:o:s:t:u:LRUPf:a:b:cdeCiF:S124896H:I:J:K:";
+static char *shortopts = "hvlqx:y:p:m:n:o:s:t:u:LRUPf:a:b:cdeCiF:Sj:124896H:I:J:K:";
 
 int dopts(int ac, char *av[]) {
   int c, i, j;
-  char *p;
-  double fudge;
-  int mask;
+  char *p, *q;
+  char *fudges = NULL;
 
   /* defaults */
 #ifdef USE_A4
@@ -259,8 +436,42 @@ int dopts(int ac, char *av[]) {
   info.percentile.y0 = 0.0;
   info.percentile.y1 = 1.0;
 
-  info.color = 0;
+  info.color = COLOR_NONE;
+  info.gray_threshold = GRAY_THRESHOLD;
   info.clip = 0;
+  info.jobs = 0;
+  info.engine = ENGINE_RASTER;
+  info.geometry = GEOMETRY_RENDER;
+  info.sample = 0;
+  info.sample_fraction = 0.0;
+  info.sample_escalate = -1.0;
+  info.cache = 0;
+  info.cachedir = NULL;
+  info.cachesize = 1024;
+  info.perpage = NULL;
+  info.perpage_fd = -1;
+  info.perpage_format = PERPAGE_TSV;
+  info.canvas_w = 0;
+  info.canvas_h = 0;
+  info.pipeline = 0;
+  info.transport = TRANSPORT_PIPE;
+  info.raster = NULL;
+  info.resolution = 72;
+  info.serve = NULL;
+  info.serve_jobs = 4;
+  info.serve_recycle = 100;
+  info.batch = NULL;
+  info.batch_count = 0;
+  info.common_layout = 0;
+  info.fudges = NULL;
+  info.fudge_count = 0;
+  info.save_hist = NULL;
+  info.load_hist = NULL;
+  info.auto_max = 0;
+  info.auto_top = 1;
+  info.fast_images = 0;
+  info.fast_text = 0;
+  info.validate = 0;
 
   while ((c = getopt_long(ac, av, shortopts, longopts, NULL)) != -1) {
     switch (c) {
@@ -435,49 +646,257 @@ int dopts(int ac, char *av[]) {
       info.bottomtotop = 1;
       break;
     case 'C':
-      info.color = 1;
+      info.color = COLOR_RGB;
       break;
     case 'i':
       info.clip = 1;
       break;
-    case 'F': {
-      p = optarg;
-      mask = 0;
-      while (1) {
-	if (*p == 'l' || *p == 'L') {
-	  mask |= MASK_LEFT;
-	} else if (*p == 'r' || *p == 'R') {
-	  mask |= MASK_RIGHT;
-	} else if (*p == 'b' || *p == 'B' || *p == 'd' || *p == 'D') {
-	  mask |= MASK_BOTTOM;
-	} else if (*p == 't' || *p == 'T' || *p == 'u' || *p == 'U') {
-	  mask |= MASK_TOP;
-	} else {
+    case 'F':
+      if (parse_fudge(optarg, &info.percentile)) {
+	fprintf(stderr, ""PSDIM": invalid percentage -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_FUDGES:
+      fudges = optarg;
+      break;
+    case OPT_SAVE_HIST:
+      info.save_hist = optarg;
+      break;
+    case OPT_LOAD_HIST:
+      info.load_hist = optarg;
+      break;
+    case OPT_GRAY:
+      info.color = COLOR_GRAY;
+      if (optarg) {
+	info.gray_threshold = strtol(optarg, &p, 10);
+	if (*p || info.gray_threshold < 0 || info.gray_threshold > 254) {
+	  fprintf(stderr, ""PSDIM": invalid gray threshold -- %s\n", optarg);
+	  exit(1);
+	}
+      }
+      break;
+    case OPT_AUTO:
+      info.auto_max = 16;
+      if (optarg) {
+	info.auto_max = strtol(optarg, &p, 10);
+	if (*p || info.auto_max < 1 || info.auto_max > AUTO_MAX) {
+	  fprintf(stderr, ""PSDIM": invalid number of pages per sheet -- %s\n", optarg);
+	  exit(1);
+	}
+      }
+      break;
+    case OPT_AUTO_TOP:
+      info.auto_top = strtol(optarg, &p, 10);
+      if (*p || info.auto_top < 1) {
+	fprintf(stderr, ""PSDIM": invalid number of layouts -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_FAST_IMAGES:
+      info.fast_images = 1;
+      break;
+    case OPT_FAST_TEXT:
+      info.fast_text = 1;
+      break;
+    case OPT_VALIDATE:
+      info.validate = 1;
+      break;
+    case 'S':
+      info.shrink = 1;
+      break;
+    case 'j':
+      info.jobs = strtol(optarg, &p, 10);
+      if (*p || info.jobs < 1) {
+	fprintf(stderr, ""PSDIM": invalid number of jobs -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_ENGINE:
+      if (strcasecmp(optarg, "raster") == 0) {
+	info.engine = ENGINE_RASTER;
+      } else if (strcasecmp(optarg, "bbox") == 0) {
+	info.engine = ENGINE_BBOX;
+      } else if (strcasecmp(optarg, "auto") == 0) {
+	info.engine = ENGINE_AUTO;
+      } else if (strcasecmp(optarg, "adaptive") == 0) {
+	info.engine = ENGINE_ADAPTIVE;
+      } else {
+	fprintf(stderr, ""PSDIM": invalid engine -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_GEOMETRY:
+      if (strcasecmp(optarg, "render") == 0) {
+	info.geometry = GEOMETRY_RENDER;
+      } else if (strcasecmp(optarg, "dsc") == 0) {
+	info.geometry = GEOMETRY_DSC;
+      } else if (strcasecmp(optarg, "auto") == 0) {
+	info.geometry = GEOMETRY_AUTO;
+      } else {
+	fprintf(stderr, ""PSDIM": invalid geometry -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_SAMPLE:
+      info.sample = strtol(optarg, &p, 10);
+      if (*p || info.sample < 1) {
+	fprintf(stderr, ""PSDIM": invalid number of pages -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_SAMPLE_FRACTION:
+      info.sample_fraction = strtod(optarg, &p);
+      if (*p || info.sample_fraction <= 0.0 || info.sample_fraction > 1.0) {
+	fprintf(stderr, ""PSDIM": invalid fraction -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_SAMPLE_ESCALATE:
+      info.sample_escalate = 0.0;
+      if (optarg) {
+	info.sample_escalate = parse_dimension(optarg, &p);
+	if (*p || info.sample_escalate < 0.0) {
+	  fprintf(stderr, ""PSDIM": invalid dimension -- %s\n", optarg);
+	  exit(1);
+	}
+      }
+      break;
+    case OPT_CACHE:
+      info.cache = 1;
+      break;
+    case OPT_CACHE_DIR:
+      info.cache = 1;
+      info.cachedir = optarg;
+      break;
+    case OPT_CACHE_SIZE:
+      info.cachesize = strtol(optarg, &p, 10);
+      if (*p || info.cachesize < 0) {
+	fprintf(stderr, ""PSDIM": invalid cache size -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_PER_PAGE:
+      /* standard output gets the page specification */
+      if (strcmp(optarg, "-") == 0) {
+	fprintf(stderr, ""PSDIM": --per-page cannot write to standard output; use --per-page-fd\n");
+	exit(1);
+      }
+      info.perpage = optarg;
+      info.perpage_fd = -1;
+      break;
+    case OPT_PER_PAGE_FD:
+      info.perpage_fd = strtol(optarg, &p, 10);
+      if (*p || info.perpage_fd < 0 || info.perpage_fd == 1) {
+	fprintf(stderr, ""PSDIM": invalid file descriptor -- %s\n", optarg);
+	exit(1);
+      }
+      info.perpage = optarg;
+      break;
+    case OPT_PER_PAGE_FORMAT:
+      if (strcmp(optarg, "tsv") == 0) {
+	info.perpage_format = PERPAGE_TSV;
+      } else if (strcmp(optarg, "json") == 0) {
+	info.perpage_format = PERPAGE_JSON;
+      } else {
+	fprintf(stderr, ""PSDIM": invalid per-page format -- %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case OPT_CANVAS:
+      for (i=0; pageformat[i].name!=NULL; i++) {
+	if (strcasecmp(pageformat[i].name, optarg)==0) 
 	  break;
+      }
+      if (pageformat[i].name) {
+	info.canvas_w = (int)ceil(pageformat[i].w);
+	info.canvas_h = (int)ceil(pageformat[i].h);
+	break;
+      }
+      /* <dim>x<dim>; the units are parsed one dimension at a time */
+      q = strchr(optarg, 'x');
+      if (q) {
+	*q = '\0';
+	info.canvas_w = (int)ceil(parse_dimension(optarg, &p));
+	p = *p ? p : q+1;
+	*q = 'x';
+	if (p == q+1) {
+	  info.canvas_h = (int)ceil(parse_dimension(q+1, &p));
 	}
-	p += 1;
       }
-      fudge = strtod(p, &p);
-      if (*p || fudge < 0.0 || fudge > 100.0) {
-	fprintf(stderr, ""PSDIM": invalid percentage -- %s\n", optarg);
+      if (!q || *p || info.canvas_w < 1 || info.canvas_h < 1
+	  || info.canvas_w > CANVAS_MAX || info.canvas_h > CANVAS_MAX) {
+	fprintf(stderr, ""PSDIM": invalid canvas -- %s\n", optarg);
+	fprintf(stderr, "Use a page format or <dim>x<dim>.\n");
 	exit(1);
       }
-      if (mask == 0 || mask & MASK_LEFT) {
-	info.percentile.x0 = fudge * 0.01;
+      break;
+    case OPT_PIPELINE:
+#ifdef HAVE_LIBGS
+      fprintf(stderr, ""PSDIM": --pipeline is not supported by this build, which renders with the ghostscript library\n");
+      exit(1);
+#endif
+#ifndef HAVE_LIBPTHREAD
+      fprintf(stderr, ""PSDIM": warning: --pipeline is not supported by this build; ignored\n");
+#endif
+      info.pipeline = 65536;
+      if (optarg) {
+	info.pipeline = strtol(optarg, &p, 10);
+	if (*p || info.pipeline < 1) {
+	  fprintf(stderr, ""PSDIM": invalid pipeline buffer size -- %s\n", optarg);
+	  exit(1);
+	}
       }
-      if (mask == 0 || mask & MASK_RIGHT) {
-	info.percentile.x1 = 1.0 - fudge * 0.01;
+#ifndef HAVE_LIBPTHREAD
+      info.pipeline = 0;
+#endif
+      break;
+    case OPT_TRANSPORT:
+      if (strcmp(optarg, "pipe") == 0) {
+	info.transport = TRANSPORT_PIPE;
+      } else if (strcmp(optarg, "shm") == 0) {
+#ifdef HAVE_LIBGS
+	fprintf(stderr, ""PSDIM": --transport=shm is not supported by this build, which renders with the ghostscript library\n");
+	exit(1);
+#endif
+	info.transport = TRANSPORT_SHM;
+      } else {
+	fprintf(stderr, ""PSDIM": invalid transport -- %s\n", optarg);
+	exit(1);
       }
-      if (mask == 0 || mask & MASK_BOTTOM) {
-	info.percentile.y0 = fudge * 0.01;
+      break;
+    case OPT_RASTER:
+      info.raster = optarg;
+      break;
+    case OPT_RESOLUTION:
+      info.resolution = strtol(optarg, &p, 10);
+      if (*p || info.resolution < 1 || info.resolution > 9600) {
+	fprintf(stderr, ""PSDIM": invalid resolution -- %s\n", optarg);
+	exit(1);
       }
-      if (mask == 0 || mask & MASK_TOP) {
-	info.percentile.y1 = 1.0 - fudge * 0.01;
+      break;
+    case OPT_BATCH:
+      info.batch = av;  /* the input files are filled in below */
+      break;
+    case OPT_COMMON_LAYOUT:
+      info.common_layout = 1;
+      break;
+    case OPT_SERVE:
+      info.serve = optarg;
+      break;
+    case OPT_SERVE_JOBS:
+      info.serve_jobs = strtol(optarg, &p, 10);
+      if (*p || info.serve_jobs < 1 || info.serve_jobs > SERVE_MAX) {
+	fprintf(stderr, ""PSDIM": invalid number of requests -- %s\n", optarg);
+	exit(1);
       }
       break;
-    }
-    case 'S':
-      info.shrink = 1;
+    case OPT_SERVE_RECYCLE:
+      info.serve_recycle = strtol(optarg, &p, 10);
+      if (*p || info.serve_recycle < 1) {
+	fprintf(stderr, ""PSDIM": invalid number of requests -- %s\n", optarg);
+	exit(1);
+      }
       break;
     case '1':
       info.land = 0;
@@ -519,6 +938,21 @@ int dopts(int ac, char *av[]) {
     }
   }
 
+  if (info.batch) {
+    if (optind == ac) {
+      fprintf(stderr, ""PSDIM": --batch needs input files\n");
+      fprintf(stderr, "Try --help for more info\n");
+      exit(1);
+    }
+    if (info.raster || info.serve || info.perpage) {
+      fprintf(stderr, ""PSDIM": --batch cannot be used with --raster, --serve, or --per-page\n");
+      fprintf(stderr, "Try --help for more info\n");
+      exit(1);
+    }
+    info.batch = av + optind;
+    info.batch_count = ac - optind;
+    optind = ac;
+  }
   if (optind < ac) {
     info.infile = av[optind];
     optind++;
@@ -528,6 +962,48 @@ int dopts(int ac, char *av[]) {
     fprintf(stderr, "Try --help for more info\n");
     exit(1);
   }
+  if (fudges && parse_fudges(fudges)) {
+    fprintf(stderr, ""PSDIM": invalid list of percentages -- %s\n", fudges);
+    exit(1);
+  }
+  if (info.load_hist && (info.infile || info.raster)) {
+    fprintf(stderr, ""PSDIM": --load-hist does not take an input file\n");
+    fprintf(stderr, "Try --help for more info\n");
+    exit(1);
+  }
+  if (info.batch && (info.fudges || info.save_hist || info.load_hist)) {
+    fprintf(stderr, ""PSDIM": --batch cannot be used with --fudges, --save-hist, or --load-hist\n");
+    fprintf(stderr, "Try --help for more info\n");
+    exit(1);
+  }
+  if (info.auto_max && (info.fudges || info.save_hist || info.load_hist
+			|| info.raster || info.batch)) {
+    fprintf(stderr, ""PSDIM": --auto cannot be used with --fudges, --save-hist, --load-hist, --raster, or --batch\n");
+    fprintf(stderr, "Try --help for more info\n");
+    exit(1);
+  }
+  if (info.validate && (!info.fast_images && !info.fast_text)) {
+    fprintf(stderr, ""PSDIM": --validate requires --fast-images or --fast-text\n");
+    fprintf(stderr, "Try --help for more info\n");
+    exit(1);
+  }
+  if (info.validate && (!info.infile || info.fudges || info.save_hist
+			|| info.load_hist || info.auto_max || info.raster
+			|| info.batch || info.serve)) {
+    fprintf(stderr, ""PSDIM": --validate requires an input file, and cannot be used with --fudges, --save-hist, --load-hist, --auto, --raster, --batch, or --serve\n");
+    fprintf(stderr, "Try --help for more info\n");
+    exit(1);
+  }
+  if (info.raster && info.infile) {
+    fprintf(stderr, ""PSDIM": --raster does not take an input file\n");
+    fprintf(stderr, "Try --help for more info\n");
+    exit(1);
+  }
+  if (info.serve && (info.infile || info.raster)) {
+    fprintf(stderr, ""PSDIM": --serve does not take an input file\n");
+    fprintf(stderr, "Try --help for more info\n");
+    exit(1);
+  }
 
   return 0;
 }
@@ -551,14 +1027,73 @@ void adjust(info_t info, int n, bbox_t *bboxes) {
   }
 }
   
-int main(int ac, char *av[]) {
+/* measure the document again, without --fast-images and --fast-text,
+   and report on stderr how far each edge of the bounding boxes of the
+   n page sets, as measured in bboxes, is from that of the full
+   rendering. Return 0 on success, or -1 with merrno set. */
+
+static int validate(int n, bbox_t *bboxes) {
+  bbox_t *full;
+  char *perpage = info.perpage;
+  int fast_images = info.fast_images, fast_text = info.fast_text;
+  int j, r, d, worst = 0;
+
+  full = (bbox_t *)malloc(n*sizeof(bbox_t));
+  if (!full) {
+    merrno = ME_MEM;
+    return -1;
+  }
+  info.fast_images = info.fast_text = 0;
+  info.perpage = NULL;
+  if (info.cache) {
+    r = psdim_cached(info.infile, n, full);
+  } else if (info.color) {
+    r = psdim_color(info.infile, n, full, &info.percentile);
+  } else {
+    r = psdim(info.infile, n, full, &info.percentile);
+  }
+  info.fast_images = fast_images;
+  info.fast_text = fast_text;
+  info.perpage = perpage;
+  if (r) {
+    free(full);
+    return -1;
+  }
+
+  /* positive differences mean that the approximation is larger */
+  for (j=0; j<n; j++) {
+    if ((bboxes[j].x0 < bboxes[j].x1) != (full[j].x0 < full[j].x1)) {
+      fprintf(stderr, ""PSDIM": validate: page set %d: %s\n", j+1,
+	      full[j].x0 < full[j].x1 ? "empty, but printed in full rendering"
+	      : "printed, but empty in full rendering");
+      continue;
+    }
+    if (full[j].x0 >= full[j].x1) {
+      continue;
+    }
+    fprintf(stderr, ""PSDIM": validate: page set %d: left %+d, right %+d, bottom %+d, top %+d points\n",
+	    j+1, full[j].x0 - bboxes[j].x0, bboxes[j].x1 - full[j].x1,
+	    full[j].y0 - bboxes[j].y0, bboxes[j].y1 - full[j].y1);
+    d = abs(full[j].x0 - bboxes[j].x0);
+    d = abs(bboxes[j].x1 - full[j].x1) > d ? abs(bboxes[j].x1 - full[j].x1) : d;
+    d = abs(full[j].y0 - bboxes[j].y0) > d ? abs(full[j].y0 - bboxes[j].y0) : d;
+    d = abs(bboxes[j].y1 - full[j].y1) > d ? abs(bboxes[j].y1 - full[j].y1) : d;
+    worst = d > worst ? d : worst;
+  }
+  fprintf(stderr, ""PSDIM": validate: largest difference %d points\n", worst);
+  free(full);
+  return 0;
+}
+
+/* measure the document and output the page format, according to
+   info. Return 0 on success, or an merrno code on error. */
+
+int psdim_run(void) {
   int n;
-  int r;
+  int r, i;
   bbox_t *bboxes;
+  hist_t *hist = NULL;
 
-  /* read command line options */
-  dopts(ac, av);
-  
   n = info.rows * info.cols;
 
   /* allocate bounding boxes for n sets of pages */
@@ -568,27 +1103,97 @@ int main(int ac, char *av[]) {
     exit(1);
   }
   
-  /* extract bounding boxes from file */
-  if (info.color) {
+  if (info.perpage && perpage_open(info.perpage, info.perpage_fd, info.perpage_format)) {
+    fprintf(stderr, ""PSDIM": %s: %s\n", info.perpage, strerror(errno));
+    exit(1);
+  }
+
+  /* extract bounding boxes from file. A cached result has no
+     per-page records. With several fudges, or to save them, the
+     pixel counts are kept, so that any percentiles can be calculated
+     from them. */
+  if (info.load_hist) {
+    r = hist_load(info.load_hist, &hist);
+  } else if ((info.fudges || info.save_hist) && info.raster) {
+    r = raster_hist(info.raster, n, 0, &hist);
+  } else if (info.fudges || info.save_hist) {
+    r = psdim_hist(info.infile, n, info.color, &hist);
+  } else if (info.auto_max) {
+    r = psdim_pages(info.infile, info.color, !info.color && info.percentile.x0 == 0.0
+		    && info.percentile.x1 == 1.0 && info.percentile.y0 == 0.0
+		    && info.percentile.y1 == 1.0, &hist);
+  } else if (info.raster) {
+    r = psdim_raster(info.raster, n, bboxes, &info.percentile);
+  } else if (info.geometry != GEOMETRY_RENDER && !info.perpage
+	     && info.percentile.x0 == 0.0 && info.percentile.x1 == 1.0
+	     && info.percentile.y0 == 0.0 && info.percentile.y1 == 1.0) {
+    r = psdim_geometry(info.infile, n, bboxes);
+  } else if (info.cache && !info.perpage) {
+    r = psdim_cached(info.infile, n, bboxes);
+  } else if (info.color) {
     r = psdim_color(info.infile, n, bboxes, &info.percentile);
   } else {
     r = psdim(info.infile, n, bboxes, &info.percentile);
   }
+  if (r == 0 && hist && hist->n != n && !info.auto_max) {
+    merrno = ME_HIST;
+    r = -1;
+  }
+  if (r == 0 && hist && info.save_hist && hist_save(hist, info.save_hist)) {
+    r = -1;
+  }
+  if (r == 0 && info.validate) {
+    r = validate(n, bboxes);
+  }
   if (r == -1) {
     if (merrno != ME_IO) {
       fprintf(stderr, ""PSDIM": %s\n", mstrerror[merrno]);
     } else {
       fprintf(stderr, ""PSDIM": %s\n", strerror(errno));
     }      
+    hist_free(hist);
+    return merrno;
+  }
+  if (perpage_close()) {
+    fprintf(stderr, ""PSDIM": %s: %s\n", info.perpage, strerror(errno));
+    hist_free(hist);
     return merrno;
   }
 
-  /* apply additional adjustment */
-  adjust(info, n, bboxes);
-
-  /* calculate and output best pstops format */
-  format(info, n, bboxes);
+  /* search for the best layouts, or apply additional adjustment,
+     and calculate and output best pstops format, once for each
+     fudge */
+  if (info.auto_max) {
+    r = psdim_auto(hist, &info.percentile, info.auto_max, info.auto_top);
+    hist_free(hist);
+    if (r) {
+      fprintf(stderr, ""PSDIM": %s\n", mstrerror[merrno]);
+      return merrno;
+    }
+    return 0;
+  }
+  for (i=0; i < (info.fudges ? info.fudge_count : 1); i++) {
+    if (hist) {
+      hist_bboxes(hist, bboxes, info.fudges ? &info.fudges[i] : &info.percentile);
+    }
+    adjust(info, n, bboxes);
+    format(info, n, bboxes);
+  }
+  hist_free(hist);
 
   return 0;
 }
 
+int main(int ac, char *av[]) {
+  /* read command line options */
+  dopts(ac, av);
+
+  if (info.serve) {
+    return psdim_serve(info.serve);
+  }
+  if (info.batch) {
+    return psdim_batch(info.batch, info.batch_count, info.jobs);
+  }
+  return psdim_run();
+}
+
@@ -29,12 +29,15 @@ typedef struct pageformat_s pageformat_t;
 /* define a set of error conditions, in the style of errno. */
 
 extern int merrno;  /* for passing error conditions */
+extern char *mstrerror[];  /* their messages */
 
 #define ME_MEM                 1
 #define ME_GSNOTFOUND          2
 #define ME_EOF                 3
 #define ME_POSTSCRIPT          4
 #define ME_IO                  5  /* errno will be set */
+#define ME_RASTER              6
+#define ME_HIST                7
 
 /* alignment policies are as follows (hpolicy): 
    0 - coordinate origins are aligned vertically and evenly spaced horizontally
@@ -44,6 +47,28 @@ extern int merrno;  /* for passing error conditions */
    4 - page groups are centered vertically, unevenly spaced horizontally.
 */
 
+/* raster transports from ghostscript */
+#define TRANSPORT_PIPE 0  /* a stream of pages on a pipe */
+#define TRANSPORT_SHM  1  /* a file per page, in shared memory */
+
+/* engines for measuring the document */
+#define ENGINE_RASTER   0  /* count the pixels of a bitmap */
+#define ENGINE_BBOX     1  /* use ghostscript's bbox device */
+#define ENGINE_AUTO     2  /* bbox if no percentiles are needed, else raster */
+#define ENGINE_ADAPTIVE 3  /* raster, coarse-to-fine if no percentiles are needed */
+
+/* sources of the bounding boxes of the pages */
+#define GEOMETRY_RENDER 0  /* measure the rendered pages */
+#define GEOMETRY_DSC    1  /* trust the boxes that the document declares */
+#define GEOMETRY_AUTO   2  /* trust them if a few rendered pages agree */
+
+/* ways of handling non-white backgrounds */
+#define COLOR_NONE 0  /* bitmaps, white is the background */
+#define COLOR_RGB  1  /* pixmaps, the first pixel is the background */
+#define COLOR_GRAY 2  /* graymaps, the most common level is the background */
+
+#define GRAY_THRESHOLD 32  /* default tolerance of --gray */
+
 struct info_s {
   double w, h;        /* width and height of output page */
   double hmargin, hsep; /* desired (outside) margin and (inside) separation */
@@ -57,10 +82,43 @@ struct info_s {
   int vpolicy;        /* vertical alignment policy */
   char *infile;       /* NULL for stdin */
   int quiet;          /* suppress stderr progress info? */
-  int color;          /* handle non-white background colors? */
+  int color;          /* one of COLOR_*: handle non-white background colors? */
+  int gray_threshold; /* with COLOR_GRAY, how far ink is from the background */
   int clip;           /* output page clipping instructions? */
   int shrink;         /* only shrink, never enlarge? */
+  int jobs;           /* number of concurrent ghostscript processes, or 0 if not given */
+  int engine;         /* one of ENGINE_* */
+  int geometry;       /* one of GEOMETRY_* */
+  int sample;         /* render only this many pages per page set, or 0 */
+  double sample_fraction; /* or this fraction of the pages, or 0 */
+  double sample_escalate; /* render all pages if the sample disagrees by more than this, if not negative */
+  int cache;          /* use the result cache? */
+  char *cachedir;     /* cache directory, or NULL for the default */
+  long cachesize;     /* size limit of the cache, in kilobytes */
+  char *perpage;      /* file for per-page records, or NULL */
+  int perpage_fd;     /* descriptor for per-page records, or -1 for the file */
+  int perpage_format; /* PERPAGE_TSV or PERPAGE_JSON */
+  int canvas_w, canvas_h; /* rendering canvas in points, or 0 to size it from the document */
+  long pipeline;      /* read pages in a separate thread, buffering this many kilobytes, or 0 */
+  int transport;      /* one of TRANSPORT_* */
+  char *raster;       /* pre-rendered pages to measure, "-" for stdin, or NULL */
+  int resolution;     /* resolution of the raster pages, in pixels per inch */
+  char *serve;        /* socket on which to answer requests, or NULL */
+  int serve_jobs;     /* number of requests handled at a time */
+  int serve_recycle;  /* restart a ghostscript after this many requests */
+  char **batch;      /* input files of --batch, or NULL */
+  int batch_count;    /* their number */
+  int common_layout;  /* one page format for all of them? */
   percentile_t percentile; /* percentiles for calculating bounding boxes */
+  percentile_t *fudges; /* percentiles of --fudges, or NULL */
+  int fudge_count;    /* their number */
+  char *save_hist;    /* file to save the histograms to, or NULL */
+  char *load_hist;    /* file to load the histograms from, or NULL */
+  int auto_max;       /* with --auto, most pages per sheet to try, else 0 */
+  int auto_top;       /* number of layouts that --auto outputs */
+  int fast_images;    /* paint images as solid rectangles? */
+  int fast_text;      /* paint text as solid rectangles? */
+  int validate;       /* compare the result with a full rendering? */
   double ladjust, radjust; /* additional bounding box adjustment left, right */
   double tadjust, badjust; /* additional bounding box adjustment top, bottom */
 };
@@ -72,6 +130,8 @@ int license(FILE *f);
 int usage(FILE *f);
 double parse_dimension(char *s, char **endptr);
 int dopts(int ac, char *av[]);
+int psdim_run(void);
+void adjust(info_t info, int n, bbox_t *bboxes);
   
 int main(int ac, char *av[]);
 
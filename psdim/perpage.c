@@ -0,0 +1,142 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* per-page output: one record for each page, with its bounding box
+   in points on the canvas, its number of ink pixels, and whether it
+   is blank. The records are written as soon as each page has been
+   rendered, either as tab-separated values or as JSON lines. Worker
+   processes buffer their records instead, and the parent writes
+   them in page order. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "scan.h"
+#include "perpage.h"
+
+static FILE *out = NULL;     /* where records go, or NULL */
+static int owned;            /* was out opened from a file? */
+static int format;           /* PERPAGE_TSV or PERPAGE_JSON */
+static int last = 0;         /* the last page written */
+static int buffering = 0;    /* keep records instead of writing them? */
+static pagestat_t *buf = NULL;
+static int count = 0, size = 0;
+
+/* start writing records to file (or to the descriptor fd, if it is
+   not -1), in the given format. Return 0 on success, or -1 with
+   merrno set. */
+
+int perpage_open(char *file, int fd, int fmt) {
+  owned = fd == -1;
+  out = owned ? fopen(file, "w") : fdopen(fd, "w");
+  if (!out) {
+    merrno = ME_IO;
+    return -1;
+  }
+  format = fmt;
+  if (format == PERPAGE_TSV) {
+    fprintf(out, "page\tx0\ty0\tx1\ty1\tink\tblank\n");
+    fflush(out);
+  }
+  return 0;
+}
+
+/* finish writing records. Return 0 on success, or -1 with merrno
+   set. */
+
+int perpage_close(void) {
+  int r = 0;
+
+  if (!out) {
+    return 0;
+  }
+  if (owned) {
+    r = fclose(out);
+  } else {
+    r = fflush(out);
+  }
+  out = NULL;
+  if (r) {
+    merrno = ME_IO;
+    return -1;
+  }
+  return 0;
+}
+
+/* write the record of a page. Pages are written in increasing order;
+   a page that is rendered a second time (e.g., because a page range
+   had to be redone) is not written again. */
+
+void perpage_page(pagestat_t *st) {
+  pagestat_t *tmp;
+  int blank;
+
+  if (buffering) {
+    if (count == size) {
+      size = size ? 2*size : 64;
+      tmp = (pagestat_t *)realloc(buf, size * sizeof(pagestat_t));
+      if (!tmp) {
+	return;
+      }
+      buf = tmp;
+    }
+    buf[count++] = *st;
+    return;
+  }
+  if (!out || st->page <= last) {
+    return;
+  }
+  last = st->page;
+  blank = st->x0 >= st->x1;
+  if (format == PERPAGE_JSON) {
+    fprintf(out, "{\"page\": %d, ", st->page);
+    if (blank) {
+      fprintf(out, "\"bbox\": null, ");
+    } else {
+      fprintf(out, "\"bbox\": [%d, %d, %d, %d], ", st->x0, st->y0, st->x1, st->y1);
+    }
+    if (st->ink < 0) {
+      fprintf(out, "\"ink\": null, ");
+    } else {
+      fprintf(out, "\"ink\": %lld, ", st->ink);
+    }
+    fprintf(out, "\"blank\": %s}\n", blank ? "true" : "false");
+  } else {
+    fprintf(out, "%d\t", st->page);
+    if (blank) {
+      fprintf(out, "-\t-\t-\t-\t");
+    } else {
+      fprintf(out, "%d\t%d\t%d\t%d\t", st->x0, st->y0, st->x1, st->y1);
+    }
+    if (st->ink < 0) {
+      fprintf(out, "-\t");
+    } else {
+      fprintf(out, "%lld\t", st->ink);
+    }
+    fprintf(out, "%d\n", blank);
+  }
+  fflush(out);
+}
+
+/* keep records in memory from now on, instead of writing them. This
+   is used by worker processes. */
+
+void perpage_buffer(void) {
+  buffering = 1;
+  count = 0;
+}
+
+/* return the number of records kept so far, and store a pointer to
+   them in *stp */
+
+int perpage_buffered(pagestat_t **stp) {
+  *stp = buf;
+  return count;
+}
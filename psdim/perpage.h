@@ -0,0 +1,20 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef PERPAGE_H
+#define PERPAGE_H
+
+#include "scan.h"
+
+#define PERPAGE_TSV  0
+#define PERPAGE_JSON 1
+
+int perpage_open(char *file, int fd, int format);
+int perpage_close(void);
+void perpage_page(pagestat_t *st);
+void perpage_buffer(void);
+int perpage_buffered(pagestat_t **stp);
+
+#endif /* PERPAGE_H */
@@ -0,0 +1,210 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* pipelined reading of ghostscript's output. A reader thread pulls
+   raw pages from the pipe into a ring of page buffers, while the
+   calling thread counts the pages in the ring. Ghostscript thus
+   keeps rendering while a page is being counted, and the counting
+   does not wait for each page to be rendered. The ring has one
+   producer and one consumer, and its indices are only ever advanced
+   by one side each, so that passing a page needs no lock; the
+   mutex is only used to sleep when the ring is full or empty. The
+   buffers in the ring are bounded by a memory budget. This is only
+   compiled if the pthread library is available. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#ifdef HAVE_LIBPTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "pipeline.h"
+
+#define SLOTS 16  /* most pages in the ring */
+
+/* the ring of pages. Slot i % cap holds page i, for tail <= i <
+   head. The reader advances head, the counter advances tail. */
+struct ring_s {
+  FILE *f;                      /* where the reader reads from */
+  pnmpage_t slot[SLOTS];
+  int cap;                      /* slots in use, set after the first page */
+  volatile size_t head, tail;   /* pages produced and consumed */
+  volatile size_t inuse;        /* bytes of pages in the ring */
+  size_t budget;                /* limit on inuse, in bytes */
+  volatile int done;            /* has the reader finished? */
+  volatile int cancel;          /* should the reader stop? */
+  int err;                      /* merrno of the reader, or 0 */
+  pthread_mutex_t lock;         /* only for sleeping */
+  pthread_cond_t cond;
+  double readwait, countwait;   /* seconds each side was stalled */
+  size_t peak;                  /* largest inuse */
+};
+typedef struct ring_s ring_t;
+
+static double now(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* wake up the other side */
+static void ring_signal(ring_t *r) {
+  pthread_mutex_lock(&r->lock);
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/* is there room for the reader to start another page? The first
+   page in an empty ring is always allowed, whatever its size. The
+   size of the next page is not known yet, so the budget is checked
+   against the largest buffer of the slot it goes into. */
+static int ring_room(ring_t *r) {
+  size_t n = __atomic_load_n(&r->head, __ATOMIC_RELAXED)
+    - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+  if (n == 0) {
+    return 1;
+  }
+  return n < (size_t)r->cap
+    && __atomic_load_n(&r->inuse, __ATOMIC_ACQUIRE) + r->slot[r->head % r->cap].datalen
+       <= r->budget;
+}
+
+static void *reader(void *arg) {
+  ring_t *r = (ring_t *)arg;
+  pnmpage_t *pg;
+  double t;
+  size_t size;
+  int k;
+
+  while (1) {
+    if (!ring_room(r)) {
+      t = now();
+      pthread_mutex_lock(&r->lock);
+      while (!ring_room(r) && !r->cancel) {
+	pthread_cond_wait(&r->cond, &r->lock);
+      }
+      pthread_mutex_unlock(&r->lock);
+      r->readwait += now() - t;
+    }
+    if (r->cancel) {
+      break;
+    }
+    pg = &r->slot[r->head % r->cap];
+    k = pnm_read(r->f, pg);
+    if (k <= 0) {
+      r->err = k < 0 ? merrno : 0;
+      break;
+    }
+    if (r->head == 0) {
+      /* as many slots as pages of this size fit into the budget, so
+	 that the buffers stay within it too */
+      r->cap = pg->size ? r->budget / pg->size : SLOTS;
+      r->cap = r->cap < 1 ? 1 : r->cap > SLOTS ? SLOTS : r->cap;
+    }
+    size = __atomic_add_fetch(&r->inuse, pg->size, __ATOMIC_ACQ_REL);
+    if (size > r->peak) {
+      r->peak = size;
+    }
+    __atomic_store_n(&r->head, r->head+1, __ATOMIC_RELEASE);
+    ring_signal(r);
+  }
+  __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+  ring_signal(r);
+  return NULL;
+}
+
+/* like read_pnm, but read the pages in a separate thread. About
+   info.pipeline kilobytes of pages are kept in memory (but always at
+   least one page); pages larger than the first one can exceed this.
+   Unless quiet, report how long each thread had to wait for the
+   other. Return the number of pages read, or -1 with
+   merrno set. */
+
+int pipeline_read_pnm(FILE *f, hist_t *hist, int first) {
+  ring_t r;
+  pthread_t thread;
+  pnmpage_t *pg;
+  double t;
+  int i, pages, err;
+
+  memset(&r, 0, sizeof(r));
+  r.f = f;
+  r.budget = (size_t)info.pipeline * 1024;
+  r.cap = SLOTS;
+  pthread_mutex_init(&r.lock, NULL);
+  pthread_cond_init(&r.cond, NULL);
+  if (pthread_create(&thread, NULL, reader, &r)) {
+    pthread_mutex_destroy(&r.lock);
+    pthread_cond_destroy(&r.cond);
+    merrno = ME_MEM;
+    return -1;
+  }
+
+  err = 0;
+  pages = 0;
+  while (1) {
+    if (__atomic_load_n(&r.tail, __ATOMIC_RELAXED) == __atomic_load_n(&r.head, __ATOMIC_ACQUIRE)) {
+      if (__atomic_load_n(&r.done, __ATOMIC_ACQUIRE)
+	  && r.tail == __atomic_load_n(&r.head, __ATOMIC_ACQUIRE)) {
+	break;
+      }
+      t = now();
+      pthread_mutex_lock(&r.lock);
+      while (r.tail == __atomic_load_n(&r.head, __ATOMIC_ACQUIRE) && !r.done) {
+	pthread_cond_wait(&r.cond, &r.lock);
+      }
+      pthread_mutex_unlock(&r.lock);
+      r.countwait += now() - t;
+      continue;
+    }
+    pg = &r.slot[r.tail % r.cap];
+    if (hist_page(hist, first+pages, pg)) {
+      err = merrno;
+      break;
+    }
+    pages++;
+    __atomic_sub_fetch(&r.inuse, pg->size, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&r.tail, r.tail+1, __ATOMIC_RELEASE);
+    ring_signal(&r);
+  }
+
+  /* stop the reader, if it is still running */
+  __atomic_store_n(&r.cancel, 1, __ATOMIC_RELEASE);
+  ring_signal(&r);
+  pthread_join(thread, NULL);
+  if (!err) {
+    err = r.err;
+  }
+
+  if (!info.quiet) {
+    progress_done();
+    fprintf(stderr, ""PSDIM": pipeline: %d pages, reader stalled %.3fs, "
+	    "counter stalled %.3fs, at most %lu kB buffered\n",
+	    pages, r.readwait, r.countwait, (unsigned long)(r.peak+1023)/1024);
+  }
+
+  for (i=0; i<SLOTS; i++) {
+    free(r.slot[i].data);
+  }
+  pthread_mutex_destroy(&r.lock);
+  pthread_cond_destroy(&r.cond);
+  if (err) {
+    merrno = err;
+    return -1;
+  }
+  return pages;
+}
+
+#endif /* HAVE_LIBPTHREAD */
@@ -0,0 +1,17 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+
+#include "psdim.h"
+
+#ifdef HAVE_LIBPTHREAD
+int pipeline_read_pnm(FILE *f, hist_t *hist, int first);
+#endif
+
+#endif /* PIPELINE_H */
@@ -18,47 +18,23 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <poll.h>
 
 #include "main.h"
 #include "psdim.h"
-
-/* x1list[n] is the index of the leftmost bit in the binary
-   representation of n. x2list[n] is the index of the rightmost
-   bit. */
-
-int x1list[] = { 8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 
-		 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 
-		 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 
-		 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 
-		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, }; 
-
-int x2list[] = { 0, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 2, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 1, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 2, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
-		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, };
+#include "scan.h"
+#include "dsc.h"
+#include "jobs.h"
+#include "bbox.h"
+#include "adapt.h"
+#include "libgs.h"
+#include "sample.h"
+#include "perpage.h"
+#include "pipeline.h"
+#include "shm.h"
+#include "serve.h"
 
 char *strcat_safe(char *dest, const char *src) {
 
@@ -113,177 +89,449 @@ int readnum(FILE *f) {
   return acc;
 }
 
-/* read zero or more portable bitmaps from GS and figure out the
-   dimension of their printed area. This information is collected for
-   all pages modulo n, e.g., if n=2, the info is summarized separately
-   for even and odd pages. Return 0 on success, or -1 with merrno
+
+/* ---------------------------------------------------------------------- */
+/* histograms */
+
+/* allocate a zeroed histogram for n page sets on a canvas of w x h
+   pixels. Return NULL on error with merrno set. */
+
+hist_t *hist_new(int n, int w, int h) {
+  hist_t *hist;
+
+  hist = (hist_t *)malloc(sizeof(hist_t));
+  if (!hist) {
+    merrno = ME_MEM;
+    return NULL;
+  }
+  hist->n = n;
+  hist->w = w;
+  hist->h = h;
+  hist->perpage = 0;
+  hist->exact = 0;
+  hist->res = 72;
+  hist->gray = 0;
+  hist->threshold = -1;
+  hist->grow = 0;
+  hist->anchor = 1;
+  hist->moved = 0;
+  hist->keep = 0;
+  hist->pages = NULL;
+  hist->npages = 0;
+  hist->scratch = NULL;
+  hist->scratchmax = NULL;
+  hist->rowcount = (long long *)calloc((size_t)n*h, sizeof(long long));
+  hist->colcount = (long long *)calloc((size_t)n*w, sizeof(long long));
+  hist->rowmax = (unsigned char *)calloc((size_t)n*h, 1);
+  hist->colmax = (unsigned char *)calloc((size_t)n*w, 1);
+  if (!hist->rowcount || !hist->colcount || !hist->rowmax || !hist->colmax) {
+    hist_free(hist);
+    merrno = ME_MEM;
+    return NULL;
+  }
+  return hist;
+}
+
+/* the number of pixels that a length of the canvas, in points, takes
+   at the resolution of --resolution */
+
+int canvas_pixels(int points) {
+  return (int)ceil(points * info.resolution / 72.0);
+}
+
+/* allocate a zeroed histogram for n page sets on the canvas, rendered
+   at the resolution of --resolution, in the way given by color (one
+   of COLOR_*). Below 72 pixels per inch, bitmaps are rendered as
+   anti-aliased graymaps instead, whose partly covered pixels give the
+   edges of the ink more precisely. Return NULL on error with merrno
    set. */
 
-int psdim(char *infile, int n, bbox_t *bboxes, percentile_t *percentile) {
-  FILE *f;
-  char *cmd;
-  int magic[2];
-  int y, i, j, b, p, c, k;
-  int w, h;          /* width, height in pixels */
-  int bpr;           /* bytes per row */
-  int rowcount[n][1008];
-  int colcount[n][1008];
-  int px0, px1, py0, py1;
-  int count;
-  int fdin, r;
-  struct stat st;
-  int top, bot;
+hist_t *hist_canvas(int n, int color) {
+  hist_t *hist;
 
-  if (infile) {
-    /* open infile */
-    fdin = open(infile, O_RDONLY);
-    if (fdin == -1) {
-      merrno = ME_IO;
-      return -1;
-    }
-    /* check that it's not a directory */
-    fstat(fdin, &st);
-    if (S_ISDIR(st.st_mode)) {
-      errno = EISDIR;
-      merrno = ME_IO;
-      return -1;
-    }
-    /* connect infile to stdin */
-    r = dup2(fdin, 0);
-    if (r == -1) {
-      merrno = ME_IO;
-      return -1;
-    }
+  hist = hist_new(n, canvas_pixels(info.canvas_w), canvas_pixels(info.canvas_h));
+  if (hist) {
+    hist->res = info.resolution;
+    hist->gray = color == COLOR_NONE && info.resolution < 72;
+    hist->threshold = color == COLOR_GRAY ? info.gray_threshold : -1;
+  }
+  return hist;
+}
+
+/* forget the kept counts of all pages */
+
+static void hist_unkeep(hist_t *hist) {
+  int i;
+
+  for (i=0; i<hist->npages; i++) {
+    free(hist->pages[i].counts);
+    free(hist->pages[i].max);
   }
+  free(hist->pages);
+  hist->pages = NULL;
+  hist->npages = 0;
+}
 
-  cmd = strdup(""GS" -q -dNOPAUSE -sDEVICE=pbmraw -g1008x1008 -sOutputFile=- -");
+void hist_free(hist_t *hist) {
+  if (hist) {
+    hist_unkeep(hist);
+    free(hist->scratch);
+    free(hist->scratchmax);
+    free(hist->rowcount);
+    free(hist->colcount);
+    free(hist->rowmax);
+    free(hist->colmax);
+    free(hist);
+  }
+}
 
-  f = popen(cmd, "r");
+/* enlarge the canvas of hist to at least w x h pixels, keeping the
+   counts. Rows are numbered from the bottom, so they keep their
+   numbers. Return 0 on success, or -1 with merrno set. */
 
-  free(cmd);
+int hist_grow(hist_t *hist, int w, int h) {
+  long long *rowcount, *colcount;
+  unsigned char *rowmax, *colmax;
+  int j;
 
-  if (!f) {
-    merrno = ME_GSNOTFOUND;
+  w = w > hist->w ? w : hist->w;
+  h = h > hist->h ? h : hist->h;
+  if (w == hist->w && h == hist->h) {
+    return 0;
+  }
+  rowcount = (long long *)calloc((size_t)hist->n*h, sizeof(long long));
+  colcount = (long long *)calloc((size_t)hist->n*w, sizeof(long long));
+  rowmax = (unsigned char *)calloc((size_t)hist->n*h, 1);
+  colmax = (unsigned char *)calloc((size_t)hist->n*w, 1);
+  if (!rowcount || !colcount || !rowmax || !colmax) {
+    free(rowcount);
+    free(colcount);
+    free(rowmax);
+    free(colmax);
+    merrno = ME_MEM;
     return -1;
   }
+  for (j=0; j<hist->n; j++) {
+    memcpy(rowcount + (size_t)j*h, hist->rowcount + (size_t)j*hist->h,
+	   hist->h * sizeof(long long));
+    memcpy(colcount + (size_t)j*w, hist->colcount + (size_t)j*hist->w,
+	   hist->w * sizeof(long long));
+    memcpy(rowmax + (size_t)j*h, hist->rowmax + (size_t)j*hist->h, hist->h);
+    memcpy(colmax + (size_t)j*w, hist->colmax + (size_t)j*hist->w, hist->w);
+  }
+  free(hist->rowcount);
+  free(hist->colcount);
+  free(hist->rowmax);
+  free(hist->colmax);
+  free(hist->scratch);
+  free(hist->scratchmax);
+  hist->rowcount = rowcount;
+  hist->colcount = colcount;
+  hist->rowmax = rowmax;
+  hist->colmax = colmax;
+  hist->scratch = NULL;
+  hist->scratchmax = NULL;
+  hist->w = w;
+  hist->h = h;
+  return 0;
+}
 
-  memset(rowcount, 0, sizeof(rowcount));
-  memset(colcount, 0, sizeof(rowcount));
+/* reset all counts to zero, and forget what the pages reported */
 
-  j = 0;  /* page counter mod n */
-  p = 1;  /* page counter */
-  c = 0;  /* column of stderr output */
+void hist_clear(hist_t *hist) {
+  memset(hist->rowcount, 0, (size_t)hist->n*hist->h*sizeof(long long));
+  memset(hist->colcount, 0, (size_t)hist->n*hist->w*sizeof(long long));
+  memset(hist->rowmax, 0, (size_t)hist->n*hist->h);
+  memset(hist->colmax, 0, (size_t)hist->n*hist->w);
+  hist_unkeep(hist);
+  hist->anchor = 1;
+  hist->moved = 0;
+}
 
-  while(1) {
-    
-    magic[0] = fgetc(f);
-    if (magic[0] == EOF) {
-      goto eof;
-    }    
+/* raise the len maxima dst to those of src */
 
-    if (magic[0] != 'P') {
-      goto format_error;
-    }    
+void max_merge(unsigned char *dst, unsigned char *src, size_t len) {
+  size_t i;
 
-    magic[1] = fgetc(f);
-    if (magic[1] != '4') {
-      goto format_error;
+  for (i=0; i<len; i++) {
+    if (src[i] > dst[i]) {
+      dst[i] = src[i];
     }
-    
-    w = readnum(f);
-    if (w<0) {
-      goto format_error;
-    }    
+  }
+}
 
-    h = readnum(f);
-    if (h<0) {
-      goto format_error;
-    }
-    
-    /* read P4 format */
-    
-    bpr = 1+(w-1)/8;
-    
-    for (y=h-1; y>=0; y--) {
-      for (i=0; i<bpr; i++) {
-	b = fgetc(f);
-	if (b==EOF) {
-	  goto eof_error;
-	}
-	if (b==0) {
-	  continue;
-	}
-	if (y < 1008 && 8*i < 1008) {
-	  for (k=0; k<8; k++) {
-	    if (b & (0x80 >> k)) {
-	      rowcount[j][y]++;
-	      colcount[j][8*i+k]++;
-	    }
-	  }
-	}
-      }
+/* add the counts of src to dst. Both must have the same dimensions. */
+
+void hist_merge(hist_t *dst, hist_t *src) {
+  size_t i;
+
+  for (i=0; i<(size_t)dst->n*dst->h; i++) {
+    dst->rowcount[i] += src->rowcount[i];
+  }
+  for (i=0; i<(size_t)dst->n*dst->w; i++) {
+    dst->colcount[i] += src->colcount[i];
+  }
+  max_merge(dst->rowmax, src->rowmax, (size_t)dst->n*dst->h);
+  max_merge(dst->colmax, src->colmax, (size_t)dst->n*dst->w);
+}
+
+/* keep the counts of page number page, which are in hist->scratch.
+   Return 0 on success, or -1 with merrno set. */
+
+static int hist_keep(hist_t *hist, int page) {
+  long long *rowcount = hist->scratch, *colcount = hist->scratch + hist->h;
+  pagehist_t *pages, *ph;
+  int i, x1, y1;
+
+  if (page >= hist->npages) {
+    pages = (pagehist_t *)realloc(hist->pages, (page+1) * sizeof(pagehist_t));
+    if (!pages) {
+      merrno = ME_MEM;
+      return -1;
     }
+    memset(pages + hist->npages, 0, (page+1 - hist->npages) * sizeof(pagehist_t));
+    hist->pages = pages;
+    hist->npages = page+1;
+  }
+  ph = &hist->pages[page];
+  free(ph->counts);
+  free(ph->max);
+  memset(ph, 0, sizeof(pagehist_t));
 
-    if (!info.quiet) {
-      c += fprintf(stderr, "[%d] ", p);
-      if (c >= 75) {
-	fprintf(stderr, "\n");
-	c = 0;
+  for (ph->y0=0; ph->y0<hist->h && rowcount[ph->y0]==0; ph->y0++);
+  for (ph->x0=0; ph->x0<hist->w && colcount[ph->x0]==0; ph->x0++);
+  for (y1=hist->h; y1>ph->y0 && rowcount[y1-1]==0; y1--);
+  for (x1=hist->w; x1>ph->x0 && colcount[x1-1]==0; x1--);
+  ph->h = y1 - ph->y0;
+  ph->w = x1 - ph->x0;
+  if (ph->h > 0 && ph->w > 0) {
+    ph->counts = (int *)malloc((ph->h + ph->w) * sizeof(int));
+    if (!ph->counts) {
+      merrno = ME_MEM;
+      return -1;
+    }
+    for (i=0; i<ph->h; i++) {
+      ph->counts[i] = rowcount[ph->y0+i];
+    }
+    for (i=0; i<ph->w; i++) {
+      ph->counts[ph->h+i] = colcount[ph->x0+i];
+    }
+    if (hist->gray) {
+      ph->max = (unsigned char *)malloc(ph->h + ph->w);
+      if (!ph->max) {
+	merrno = ME_MEM;
+	return -1;
       }
+      memcpy(ph->max, hist->scratchmax + ph->y0, ph->h);
+      memcpy(ph->max + ph->h, hist->scratchmax + hist->h + ph->x0, ph->w);
     }
+  }
+  return 0;
+}
 
-    j = (j+1) % n;
-    p++;
-  } /* while(1) */
+/* add the counts of page number page, which are in hist->scratch, to
+   its page set */
 
- eof_error:
-  pclose(f);
-  if (!info.quiet && c!=0) {
-    fprintf(stderr, "\n");
+static void hist_add(hist_t *hist, int page) {
+  long long *rowcount, *colcount;
+  int i;
+
+  rowcount = hist->rowcount + (size_t)(page % hist->n)*hist->h;
+  colcount = hist->colcount + (size_t)(page % hist->n)*hist->w;
+  for (i=0; i<hist->h; i++) {
+    rowcount[i] += hist->scratch[i];
   }
-  merrno = ME_EOF;
-  return -1;
+  for (i=0; i<hist->w; i++) {
+    colcount[i] += hist->scratch[hist->h+i];
+  }
+  max_merge(hist->rowmax + (size_t)(page % hist->n)*hist->h, hist->scratchmax, hist->h);
+  max_merge(hist->colmax + (size_t)(page % hist->n)*hist->w, hist->scratchmax + hist->h,
+	    hist->w);
+}
 
- format_error:
-  pclose(f);
-  if (!info.quiet && c!=0) {
-    fprintf(stderr, "\n");
+/* a page, whose counts are in hist->scratch, asked for a page height
+   of size points. If all of its ink lies in the top size points of
+   the canvas, and some of it above the bottom size points, it was
+   placed relative to the top of the canvas; move it to the bottom.
+   Also move its extent st, if not NULL. */
+
+static void hist_shift(hist_t *hist, double size, pagestat_t *st) {
+  long long *rowcount = hist->scratch;
+  int h = hist->h;
+  int ph, top, bot, shift, i;
+
+  ph = (int)ceil(size * hist->res / 72.0);
+  if (ph <= 0 || ph >= h) {
+    return;
   }
-  merrno = ME_POSTSCRIPT;
-  return -1;
-  
- eof:
-  if (!info.quiet && c!=0) {
-    fprintf(stderr, "\n");
+  for (bot=0; bot<h && rowcount[bot]==0; bot++);
+  for (top=h-1; top>=bot && rowcount[top]==0; top--);
+  if (top < ph || bot < h-ph) {
+    return;
+  }
+  shift = h - ph;
+  hist->moved++;
+  for (i=0; i<ph; i++) {
+    rowcount[i] = rowcount[i+shift];
+    rowcount[i+shift] = 0;
+    hist->scratchmax[i] = hist->scratchmax[i+shift];
+    hist->scratchmax[i+shift] = 0;
+  }
+  if (st && st->y0 < st->y1) {
+    st->y0 -= shift;
+    st->y1 -= shift;
+  }
+}
+
+/* make a new histogram for n page sets from the pages kept in hist,
+   so that it need not be rendered again. Return NULL on error with
+   merrno set. */
+
+hist_t *hist_regroup(hist_t *hist, int n) {
+  hist_t *new;
+  pagehist_t *ph;
+  long long *rowcount, *colcount;
+  int i, p;
+
+  new = hist_new(n, hist->w, hist->h);
+  if (!new) {
+    return NULL;
+  }
+  new->exact = hist->exact;
+  new->res = hist->res;
+  new->gray = hist->gray;
+  new->threshold = hist->threshold;
+  new->anchor = hist->anchor;
+  for (p=0; p<hist->npages; p++) {
+    ph = &hist->pages[p];
+    if (!ph->counts) {
+      continue;
+    }
+    rowcount = new->rowcount + (size_t)(p % n)*new->h + ph->y0;
+    colcount = new->colcount + (size_t)(p % n)*new->w + ph->x0;
+    for (i=0; i<ph->h; i++) {
+      rowcount[i] += ph->counts[i];
+    }
+    for (i=0; i<ph->w; i++) {
+      colcount[i] += ph->counts[ph->h+i];
+    }
+    if (ph->max) {
+      max_merge(new->rowmax + (size_t)(p % n)*new->h + ph->y0, ph->max, ph->h);
+      max_merge(new->colmax + (size_t)(p % n)*new->w + ph->x0, ph->max + ph->h, ph->w);
+    }
+  }
+  return new;
+}
+
+/* handle the special case of certain PostScript files produced by
+   Acrobat Reader that anchor the page in the top left corner of the
+   canvas, instead of the bottom left corner. Such pages are normally
+   moved by hist_page, using the page size that the page size prelude
+   reports. Where there is no report, we use a heuristic, based on the
+   topmost and bottommost inked rows of a canvas of height h. */
+
+void anchor_fixup(int n, bbox_t *bboxes, int h, int top, int bot) {
+  int j;
+
+  if (top >= 842 && bot > h-842) {
+    for (j=0; j<n; j++) {
+      bboxes[j].y0 -= h - 792;
+      bboxes[j].y1 -= h - 792;
+    }
+  }
+}
+
+/* convert the box x0 y0 x1 y1 from pixels at res pixels per inch to
+   points, rounding outwards */
+
+void pixels_to_points(int *x0, int *y0, int *x1, int *y1, int res) {
+  *x0 = (int)floor(*x0 * 72.0 / res);
+  *y0 = (int)floor(*y0 * 72.0 / res);
+  *x1 = (int)ceil(*x1 * 72.0 / res);
+  *y1 = (int)ceil(*y1 * 72.0 / res);
+}
+
+/* the part of the width of the pixels of an edge row or column of an
+   anti-aliased graymap that the ink reaches into, given the most
+   coverage edge of any one of its pixels, and the most coverage inner
+   of any pixel of its neighbour further inside. Where solid ink lies
+   behind it, the ink ends along a line across the edge pixels, and
+   covers as much of them as it reaches into. Small marks on their own
+   cover little of a pixel however far they reach, so they leave the
+   edge where it is, as does a fully covered pixel. */
+
+static double edge_cover(int edge, int inner) {
+  return inner == 255 ? edge / 255.0 : 1.0;
+}
+
+/* convert the bounding box b of page set j of hist from pixels to
+   points, rounding outwards. On anti-aliased graymaps, the edges at
+   the outermost ink (those whose percentile is 0 or 1) are first
+   moved into their pixels by the part that the ink does not cover. */
+
+static void hist_points(hist_t *hist, int j, bbox_t *b, percentile_t *percentile) {
+  unsigned char *rowmax = hist->rowmax + (size_t)j*hist->h;
+  unsigned char *colmax = hist->colmax + (size_t)j*hist->w;
+  double scale = 72.0 / hist->res;
+  double x0 = b->x0, y0 = b->y0, x1 = b->x1, y1 = b->y1;
+
+  if (hist->gray && b->x0 < b->x1 && b->y0 < b->y1) {
+    if (percentile->x0 == 0.0 && b->x0+1 < b->x1) {
+      x0 += 1.0 - edge_cover(colmax[b->x0], colmax[b->x0+1]);
+    }
+    if (percentile->x1 == 1.0 && b->x0+1 < b->x1) {
+      x1 -= 1.0 - edge_cover(colmax[b->x1-1], colmax[b->x1-2]);
+    }
+    if (percentile->y0 == 0.0 && b->y0+1 < b->y1) {
+      y0 += 1.0 - edge_cover(rowmax[b->y0], rowmax[b->y0+1]);
+    }
+    if (percentile->y1 == 1.0 && b->y0+1 < b->y1) {
+      y1 -= 1.0 - edge_cover(rowmax[b->y1-1], rowmax[b->y1-2]);
+    }
   }
-  pclose(f);
-  /* note: we now ignore the return value of pclose, as this was
-     sometimes -1 (with errno=ECHILD) although everything worked fine. */
+  /* allow for rounding errors in the scaling */
+  b->x0 = (int)floor(x0 * scale + 1e-9);
+  b->y0 = (int)floor(y0 * scale + 1e-9);
+  b->x1 = (int)ceil(x1 * scale - 1e-9);
+  b->y1 = (int)ceil(y1 * scale - 1e-9);
+}
 
-  /* figure out bounding boxes from row/column counts for each page set */
+/* figure out bounding boxes from row/column counts for each page set */
+
+void hist_bboxes(hist_t *hist, bbox_t *bboxes, percentile_t *percentile) {
+  int i, j;
+  int n = hist->n;
+  int w = hist->w;
+  int h = hist->h;
+  long long *rowcount, *colcount;
+  long long px0, px1, py0, py1;
+  long long count;
+  int top, bot;
 
   for (j=0; j<n; j++) {
+    rowcount = hist->rowcount + (size_t)j*h;
+    colcount = hist->colcount + (size_t)j*w;
     count = 0;   /* total pixels this page */
-    for (i=0; i<1008; i++) {
-      count += rowcount[j][i];
+    for (i=0; i<h; i++) {
+      count += rowcount[i];
     }
     if (count == 0) { /* no pixels */
-      bboxes[j].x0 = 1008;
-      bboxes[j].y0 = 1008;
+      bboxes[j].x0 = w;
+      bboxes[j].y0 = h;
       bboxes[j].x1 = 0;
       bboxes[j].y1 = 0;
     } else {
       /* percentiles */
-      px0 = (int)floor(count * percentile->x0);
-      px1 = (int)ceil(count * percentile->x1);
-      py0 = (int)floor(count * percentile->y0);
-      py1 = (int)ceil(count * percentile->y1);
+      px0 = (long long)floor(count * percentile->x0);
+      px1 = (long long)ceil(count * percentile->x1);
+      py0 = (long long)floor(count * percentile->y0);
+      py1 = (long long)ceil(count * percentile->y1);
 
       count = 0;
       bboxes[j].x0 = 0;
       bboxes[j].x1 = 0;
-      for (i=0; i<1008; i++) {
-	count += colcount[j][i];
+      for (i=0; i<w; i++) {
+	count += colcount[i];
 	if (count <= px0) {
 	  bboxes[j].x0 = i+1;
 	}
@@ -294,8 +542,8 @@ int psdim(char *infile, int n, bbox_t *bboxes, percentile_t *percentile) {
       count = 0;
       bboxes[j].y0 = 0;
       bboxes[j].y1 = 0;
-      for (i=0; i<1008; i++) {
-	count += rowcount[j][i];
+      for (i=0; i<h; i++) {
+	count += rowcount[i];
 	if (count <= py0) {
 	  bboxes[j].y0 = i+1;
 	}
@@ -306,258 +554,1183 @@ int psdim(char *infile, int n, bbox_t *bboxes, percentile_t *percentile) {
     }
   }
 
-  /* handle the special case of certain PostScript files produced by
-     Acrobat Reader that anchor the page in the top left corner of the
-     canvas, instead of the bottom left corner. The only way to detect
-     this for sure would be to render the image twice. Here we use a
-     heuristic. */
   top = 0;
-  bot = 1008;
-  for (i=0; i<1008; i++) {
+  bot = h;
+  for (i=0; i<h; i++) {
     for (j=0; j<n; j++) {
-      if (rowcount[j][i] != 0) {
+      if (hist->rowcount[(size_t)j*h+i] != 0) {
 	top = i;
-	if (bot == 1008) {
+	if (bot == h) {
 	  bot = i;
 	}
       }
     }
   }
-  if (top >= 842 && bot > 1008-842) {
+  if (hist->res != 72) {
     for (j=0; j<n; j++) {
-      bboxes[j].y0 -= 1008 - 792;
-      bboxes[j].y1 -= 1008 - 792;
+      hist_points(hist, j, &bboxes[j], percentile);
+    }
+    top = (int)floor(top * 72.0 / hist->res);
+    bot = (int)floor(bot * 72.0 / hist->res);
+    h = (int)floor(h * 72.0 / hist->res);
+  }
+  if (hist->anchor) {
+    anchor_fixup(n, bboxes, h, top, bot);
+  }
+}
+
+/* write hist to the file path, so that bounding boxes for other
+   percentiles can later be calculated without rendering. The file
+   holds the size of the histogram, then a line of row counts and a
+   line of column counts for each page set, followed, for anti-aliased
+   graymaps, by a line of row maxima and one of column maxima. Return
+   0 on success, or -1 with merrno set. */
+
+int hist_save(hist_t *hist, char *path) {
+  FILE *f;
+  int i, j, err;
+
+  f = fopen(path, "w");
+  if (!f) {
+    merrno = ME_IO;
+    return -1;
+  }
+  fprintf(f, HIST_MAGIC"\n");
+  fprintf(f, "n %d w %d h %d res %d gray %d anchor %d\n", hist->n, hist->w,
+	  hist->h, hist->res, hist->gray, hist->anchor);
+  for (j=0; j<hist->n; j++) {
+    fprintf(f, "rows");
+    for (i=0; i<hist->h; i++) {
+      fprintf(f, " %lld", hist->rowcount[(size_t)j*hist->h+i]);
+    }
+    fprintf(f, "\ncols");
+    for (i=0; i<hist->w; i++) {
+      fprintf(f, " %lld", hist->colcount[(size_t)j*hist->w+i]);
+    }
+    fprintf(f, "\n");
+    if (hist->gray) {
+      fprintf(f, "rowmax");
+      for (i=0; i<hist->h; i++) {
+	fprintf(f, " %d", hist->rowmax[(size_t)j*hist->h+i]);
+      }
+      fprintf(f, "\ncolmax");
+      for (i=0; i<hist->w; i++) {
+	fprintf(f, " %d", hist->colmax[(size_t)j*hist->w+i]);
+      }
+      fprintf(f, "\n");
     }
   }
-  
+  err = ferror(f);
+  if (fclose(f) || err) {
+    merrno = ME_IO;
+    return -1;
+  }
   return 0;
 }
 
-/* like psdim, except use colored bitmaps. Return 0 on error, else -1
-   with merrno set. NOTE: this calculates the right dimensions;
-   however, pstops does not work well on colored backgrounds due to
-   stupid cropping. */
+/* read a histogram written by hist_save from the file path, and store
+   it in *histp. Return 0 on success, or -1 with merrno set. */
 
-int psdim_color(char *infile, int n, bbox_t *bboxes, percentile_t *percentile) {
+int hist_load(char *path, hist_t **histp) {
   FILE *f;
-  char *cmd;
-  int magic[2];
-  int y, x, i, j, b, p, c;
-  int maxval, bpp;
-  int w, h;          /* width, height in pixels */
-  int ink, first;
-  unsigned char pix[6];
-  int rowcount[n][1008];
-  int colcount[n][1008];
-  int px0, px1, py0, py1;
-  int count;
-  int fdin, r;
-  int top, bot;
-  struct stat st;
+  hist_t *hist = NULL;
+  char line[32], word[8];
+  int i, j, n, w, h, res, gray, anchor, max;
 
-  if (infile) {
-    /* open infile */
-    fdin = open(infile, O_RDONLY);
-    if (fdin == -1) {
-      merrno = ME_IO;
-      return -1;
+  f = fopen(path, "r");
+  if (!f) {
+    merrno = ME_IO;
+    return -1;
+  }
+  merrno = ME_HIST;
+  if (!fgets(line, sizeof(line), f) || strcmp(line, HIST_MAGIC"\n") != 0) {
+    goto fail;
+  }
+  if (fscanf(f, " n %d w %d h %d res %d gray %d anchor %d", &n, &w, &h, &res,
+	     &gray, &anchor) != 6 || n < 1 || w < 1 || h < 1 || res < 1) {
+    goto fail;
+  }
+  hist = hist_new(n, w, h);
+  if (!hist) {
+    goto fail;
+  }
+  hist->res = res;
+  hist->gray = gray;
+  hist->anchor = anchor;
+  for (j=0; j<n; j++) {
+    if (fscanf(f, " %7s", word) != 1 || strcmp(word, "rows") != 0) {
+      goto fail;
     }
-    /* check that it's not a directory */
-    fstat(fdin, &st);
-    if (S_ISDIR(st.st_mode)) {
-      errno = EISDIR;
-      merrno = ME_IO;
-      return -1;
+    for (i=0; i<h; i++) {
+      if (fscanf(f, "%lld", &hist->rowcount[(size_t)j*h+i]) != 1) {
+	goto fail;
+      }
     }
-    /* connect infile to stdin */
-    r = dup2(fdin, 0);
-    if (r == -1) {
-      merrno = ME_IO;
-      return -1;
+    if (fscanf(f, " %7s", word) != 1 || strcmp(word, "cols") != 0) {
+      goto fail;
+    }
+    for (i=0; i<w; i++) {
+      if (fscanf(f, "%lld", &hist->colcount[(size_t)j*w+i]) != 1) {
+	goto fail;
+      }
+    }
+    if (!gray) {
+      continue;
+    }
+    if (fscanf(f, " %7s", word) != 1 || strcmp(word, "rowmax") != 0) {
+      goto fail;
+    }
+    for (i=0; i<h; i++) {
+      if (fscanf(f, "%d", &max) != 1 || max < 0 || max > 255) {
+	goto fail;
+      }
+      hist->rowmax[(size_t)j*h+i] = max;
+    }
+    if (fscanf(f, " %7s", word) != 1 || strcmp(word, "colmax") != 0) {
+      goto fail;
+    }
+    for (i=0; i<w; i++) {
+      if (fscanf(f, "%d", &max) != 1 || max < 0 || max > 255) {
+	goto fail;
+      }
+      hist->colmax[(size_t)j*w+i] = max;
     }
   }
+  fclose(f);
+  *histp = hist;
+  return 0;
+
+ fail:
+  fclose(f);
+  hist_free(hist);
+  return -1;
+}
 
-  cmd = strdup(""GS" -q -dNOPAUSE -sDEVICE=ppmraw -g1008x1008 -sOutputFile=- -");
+/* ---------------------------------------------------------------------- */
+/* running ghostscript */
 
-  f = popen(cmd, "r");
+/* like gs_open, but if side is not NULL, also connect ghostscript's
+   standard error to a pipe, whose non-blocking reading end is stored
+   in *side */
 
-  free(cmd);
+FILE *gs_spawn(char *argv[], int fdin, int out, int *side, pid_t *pid) {
+  int fd[2], sd[2];
+  int null;
+  pid_t p;
+  FILE *f;
 
+  if (pipe(fd) == -1) {
+    merrno = ME_IO;
+    return NULL;
+  }
+  if (side && pipe(sd) == -1) {
+    close(fd[0]);
+    close(fd[1]);
+    merrno = ME_IO;
+    return NULL;
+  }
+  p = fork();
+  if (p == -1) {
+    close(fd[0]);
+    close(fd[1]);
+    if (side) {
+      close(sd[0]);
+      close(sd[1]);
+    }
+    merrno = ME_IO;
+    return NULL;
+  }
+  if (p == 0) {
+    /* child */
+    if (fdin != -1) {
+      dup2(fdin, 0);
+      close(fdin);
+    }
+    dup2(fd[1], out);
+    close(fd[0]);
+    close(fd[1]);
+    if (side) {
+      dup2(sd[1], 2);
+      close(sd[0]);
+      close(sd[1]);
+    }
+    if (out == 2) {
+      null = open("/dev/null", O_WRONLY);
+      if (null != -1) {
+	dup2(null, 1);
+	close(null);
+      }
+    }
+    argv[0] = GS;
+    execvp(GS, argv);
+    _exit(127);
+  }
+  close(fd[1]);
+  if (side) {
+    close(sd[1]);
+    fcntl(sd[0], F_SETFL, O_NONBLOCK);
+    *side = sd[0];
+  }
+  f = fdopen(fd[0], "r");
   if (!f) {
+    close(fd[0]);
+    if (side) {
+      close(sd[0]);
+    }
+    kill(p, SIGTERM);
+    waitpid(p, NULL, 0);
+    merrno = ME_MEM;
+    return NULL;
+  }
+  *pid = p;
+  return f;
+}
+
+/* start ghostscript with the argument vector argv (argv[0] is
+   ignored). Its standard input is connected to the file descriptor
+   fdin, or inherited if fdin is -1. Return a stream connected to its
+   standard output (if out is 1) or its standard error (if out is 2;
+   its standard output is then discarded), and store its process id
+   in *pid. Return NULL on error with merrno set. */
+
+FILE *gs_open(char *argv[], int fdin, int out, pid_t *pid) {
+  return gs_spawn(argv, fdin, out, NULL, pid);
+}
+
+/* close a stream returned by gs_open, and wait for ghostscript to
+   terminate. Return 0 on success, or -1 with merrno set if
+   ghostscript could not be started. Other exit codes are ignored, as
+   ghostscript reports errors in the document on stderr anyway. */
+
+int gs_close(FILE *f, pid_t pid) {
+  int status;
+
+  fclose(f);
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      return 0;
+    }
+  }
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
     merrno = ME_GSNOTFOUND;
     return -1;
   }
+  return 0;
+}
 
-  memset(rowcount, 0, sizeof(rowcount));
-  memset(colcount, 0, sizeof(rowcount));
+/* fill in the ghostscript arguments for rendering the document on
+   stdin to a portable bitmap (or pixmap or graymap, as given by
+   color, one of COLOR_*) on stdout. argv must have room for GS_ARGS entries. Return the number
+   of arguments, not counting the terminating NULL. The caller may
+   replace the final "-" by a file name, or insert further options
+   before it. */
 
-  j = 0;  /* page counter mod n */
-  p = 1;  /* page counter */
-  c = 0;  /* column of stderr output */
+int gs_args(char *argv[], int color) {
+  static char geom[32], res[16];
+  int i = 0;
 
-  while(1) {
-    
-    magic[0] = fgetc(f);
-    if (magic[0] == EOF)
-      goto eof;
-    
-    if (magic[0] != 'P')
-      goto format_error;
-    
-    magic[1] = fgetc(f);
-    if (magic[1] != '6')
-      goto format_error;
-    
-    w = readnum(f);
-    if (w<0)
-      goto format_error;
-    
-    h = readnum(f);
-    if (h<0)
-      goto format_error;
+  argv[i++] = GS;
+  argv[i++] = "-q";
+  argv[i++] = "-dNOPAUSE";
+  if (color == COLOR_RGB) {
+    argv[i++] = "-sDEVICE=ppmraw";
+  } else if (color == COLOR_GRAY) {
+    argv[i++] = "-sDEVICE=pgmraw";
+  } else if (info.resolution < 72) {
+    /* anti-aliased, as hist_canvas expects */
+    argv[i++] = "-sDEVICE=pgmraw";
+    argv[i++] = "-dGraphicsAlphaBits=4";
+    argv[i++] = "-dTextAlphaBits=4";
+  } else {
+    argv[i++] = "-sDEVICE=pbmraw";
+  }
+  sprintf(geom, "-g%dx%d", canvas_pixels(info.canvas_w), canvas_pixels(info.canvas_h));
+  argv[i++] = geom;
+  if (info.resolution != 72) {
+    sprintf(res, "-r%d", info.resolution);
+    argv[i++] = res;
+  }
+  argv[i++] = "-sOutputFile=-";
+  argv[i++] = "-";
+  argv[i] = NULL;
+  return gs_fast(argv, i);
+}
 
-    maxval = readnum(f);
-    if (maxval<1 || maxval>=65536)
-      goto format_error;
+/* a prelude for --fast-images that paints each image as a solid
+   rectangle covering the image's unit square: in black for image and
+   colorimage, and in the current color for imagemask. The image data
+   is read and discarded, so that inline data is skipped, but never
+   decoded or resampled. Image dictionaries other than ImageType 1 are
+   drawn as usual. */
 
-    bpp = (maxval >= 256) ? 6 : 3;   /* bytes per pixel */
-    
-    /* read P6 format */
-    
-    first = 1;
-    for (y=h-1; y>=0; y--) {
-      for (x=0; x<w; x++) {
-	if (first) {
-	  for (i=0; i<bpp; i++) {
-	    b = fgetc(f);
-	    if (b==EOF)
-	      goto eof_error;
-	    pix[i] = b;
-	  }
-	  first = 0;
-	} else {
-	  ink = 0;
-	  for (i=0; i<bpp; i++) {
-	    b = fgetc(f);
-	    if (b==EOF)
-	      goto eof_error;
-	    if (b != pix[i]) {
-	      ink = 1;
-	    }
-	  }
-	  if (ink) {
-	    if (y < 1008 && x < 1008) {
-	      rowcount[j][y]++;
-	      colcount[j][x]++;
-	    }
+static char images_prelude[] =
+  "/psdim_skip { { dup 0 le { exit } if 1 index type /stringtype eq { exit } if"
+  " 1 index type /filetype eq"
+  " { dup 65535 gt { 65535 } { dup } ifelse string 2 index exch readstring"
+  " { length sub } { pop pop 0 } ifelse }"
+  " { 1 index exec length dup 0 eq { pop pop 0 } { sub } ifelse } ifelse"
+  " } loop pop pop } bind def"
+  " /psdim_dict { dup /Width get 1 index /BitsPerComponent known"
+  " { 1 index /BitsPerComponent get } { 1 } ifelse mul"
+  " 1 index /MultipleDataSources known { 1 index /MultipleDataSources get } { false } ifelse"
+  " { 7 add 8 idiv 1 index /Height get mul exch /DataSource get"
+  " { 1 index psdim_skip } forall pop }"
+  " { 1 index /Decode get length 2 idiv mul 7 add 8 idiv 1 index /Height get mul"
+  " exch /DataSource get exch psdim_skip } ifelse } bind def"
+  " /psdim_fill { gsave 0 setgray 0 0 1 1 rectfill grestore } bind def"
+  " /image { dup type /dicttype eq"
+  " { dup /ImageType get 1 eq { psdim_dict psdim_fill }"
+  " { //systemdict /image get exec } ifelse }"
+  " { 5 1 roll pop 3 -1 roll mul 7 add 8 idiv mul psdim_skip psdim_fill } ifelse"
+  " } bind def"
+  " /imagemask { dup type /dicttype eq"
+  " { dup /ImageType get 1 eq { psdim_dict 0 0 1 1 rectfill }"
+  " { //systemdict /imagemask get exec } ifelse }"
+  " { 5 1 roll pop pop exch 7 add 8 idiv mul psdim_skip 0 0 1 1 rectfill } ifelse"
+  " } bind def"
+  " /colorimage { exch { 1 exch } { 1 } ifelse"
+  " dup 5 add index 1 index 4 add index mul 2 index mul 7 add 8 idiv"
+  " 1 index 5 add index mul exch { 3 -1 roll 1 index psdim_skip } repeat"
+  " 6 { pop } repeat psdim_fill } bind def";
+
+/* a prelude for --fast-text that fills a rectangle for each string
+   shown, instead of drawing its glyphs: the font's bounding box, swept
+   from the current point to the end of the string. Only fonts with a
+   bounding box are approximated; text in other fonts, and text shown
+   with kshow, cshow or glyphshow, is drawn as usual. */
+
+static char text_prelude[] =
+  "/psdim_tdict 32 dict def"
+  " /psdim_ok { currentfont dup /FontType get 0 ne 1 index /FontBBox known and"
+  " { /FontBBox get aload pop 3 -1 roll sub 3 1 roll sub mul 0 ne }"
+  " { pop false } ifelse } bind def"
+  " /psdim_arr { dup type dup /arraytype eq exch /packedarraytype eq or } bind def"
+  " /psdim_ext { dup y0 lt { dup /y0 exch def } if dup y1 gt { dup /y1 exch def } if pop"
+  " dup x0 lt { dup /x0 exch def } if dup x1 gt { dup /x1 exch def } if pop } bind def"
+  " /psdim_box { psdim_tdict begin /dy exch def /dx exch def"
+  " currentfont dup /FontMatrix get /fm exch def /FontBBox get aload pop"
+  " /ury exch def /urx exch def /lly exch def /llx exch def"
+  " /x0 1e30 def /y0 1e30 def /x1 -1e30 def /y1 -1e30 def"
+  " /c [llx lly llx ury urx lly urx ury] def"
+  " 0 2 6 { dup c exch get exch 1 add c exch get fm transform"
+  " 2 copy psdim_ext dy add exch dx add exch psdim_ext } for"
+  " currentpoint y0 add exch x0 add exch x1 x0 sub y1 y0 sub rectfill"
+  " dx dy end rmoveto } bind def"
+  " /psdim_adv { s stringwidth /wy exch def /wx exch def"
+  " /k 0 def s { ch eq { /k k 1 add def } if } forall"
+  " wx s length ax mul add k cx mul add wy s length ay mul add k cy mul add } bind def"
+  " /show { psdim_ok { psdim_tdict begin /s exch def /ax 0 def /ay 0 def"
+  " /cx 0 def /cy 0 def /ch -1 def psdim_adv end psdim_box }"
+  " { //systemdict /show get exec } ifelse } bind def"
+  " /ashow { psdim_ok { psdim_tdict begin /s exch def /ay exch def /ax exch def"
+  " /cx 0 def /cy 0 def /ch -1 def psdim_adv end psdim_box }"
+  " { //systemdict /ashow get exec } ifelse } bind def"
+  " /widthshow { psdim_ok { psdim_tdict begin /s exch def /ch exch def /cy exch def"
+  " /cx exch def /ax 0 def /ay 0 def psdim_adv end psdim_box }"
+  " { //systemdict /widthshow get exec } ifelse } bind def"
+  " /awidthshow { psdim_ok { psdim_tdict begin /s exch def /ay exch def /ax exch def"
+  " /ch exch def /cy exch def /cx exch def psdim_adv end psdim_box }"
+  " { //systemdict /awidthshow get exec } ifelse } bind def"
+  " /xshow { psdim_arr psdim_ok and { 0 exch { add } forall exch pop 0 psdim_box }"
+  " { //systemdict /xshow get exec } ifelse } bind def"
+  " /yshow { psdim_arr psdim_ok and { 0 exch { add } forall exch pop 0 exch psdim_box }"
+  " { //systemdict /yshow get exec } ifelse } bind def"
+  " /xyshow { psdim_arr psdim_ok and { psdim_tdict begin /a exch def pop 0 0"
+  " 0 2 a length 1 sub { dup a exch get exch 1 add a exch get"
+  " 3 -1 roll add 3 1 roll add exch } for end psdim_box }"
+  " { //systemdict /xyshow get exec } ifelse } bind def";
+
+/* insert the preludes of --fast-images and --fast-text, if given,
+   into the ghostscript arguments argv, with argc arguments, before
+   the final "-". Return the new number of arguments. */
+
+int gs_fast(char *argv[], int argc) {
+  if (!info.fast_images && !info.fast_text) {
+    return argc;
+  }
+  argc--;  /* the final "-" */
+  argv[argc++] = "-c";
+  if (info.fast_images) {
+    argv[argc++] = images_prelude;
+  }
+  if (info.fast_text) {
+    argv[argc++] = text_prelude;
+  }
+  argv[argc++] = "-f";
+  argv[argc++] = "-";
+  argv[argc] = NULL;
+  return argc;
+}
+
+/* change the ghostscript arguments from gs_args, with argc
+   arguments, to render only the window win of the canvas. The page
+   size and resolution are those of the window, and a prelude moves
+   the window to the origin of the page. Bitmaps below 72 dpi become
+   anti-aliased graymaps, as in gs_args, so that marks smaller than a
+   pixel do not drop out. The argument strings are stored in win.
+   Return the new number of arguments. */
+
+int gs_window(char *argv[], int argc, window_t *win) {
+  int i, gray = 0;
+
+  sprintf(win->geom, "-g%dx%d", win->w*win->res/72, win->h*win->res/72);
+  sprintf(win->resarg, "-r%d", win->res);
+  sprintf(win->prelude, "<< /Install { %d %d translate } bind >> setpagedevice",
+	  -win->x, -win->y);
+
+  for (i=0; i<argc; i++) {
+    if (strncmp(argv[i], "-g", 2) == 0) {
+      argv[i] = win->geom;
+    } else if (strcmp(argv[i], "-sDEVICE=pbmraw") == 0 && win->res < 72) {
+      argv[i] = "-sDEVICE=pgmraw";
+      gray = 1;
+    }
+  }
+  argc--;  /* the final "-" */
+  if (gray) {
+    argv[argc++] = "-dGraphicsAlphaBits=4";
+    argv[argc++] = "-dTextAlphaBits=4";
+  }
+  argv[argc++] = win->resarg;
+  argv[argc++] = "-dFIXEDMEDIA";
+  argv[argc++] = "-c";
+  argv[argc++] = win->prelude;
+  argv[argc++] = "-f";
+  argv[argc++] = "-";
+  argv[argc] = NULL;
+  return argc;
+}
+
+/* a prelude that reports the page size the document asked for, on
+   standard error, as a line "%%psdim-page <w> <h>" for each page
+   before it is output; "0 0" if it did not ask for any. The media
+   stays fixed by -dFIXEDMEDIA, so that nothing is cut off, but the
+   document may still place its pages relative to the top of the
+   canvas, as PostScript from Acrobat Reader does. Knowing the page
+   size, such pages are moved to the bottom of the canvas, where they
+   belong. */
+
+#define PAGESIZE_PRELUDE(file, fix) \
+  "/psdim_req null def" \
+  " << /EndPage { exch pop 2 ne dup { (" file ") (w) file" \
+  " dup (%%psdim-page) writestring" \
+  " userdict /psdim_req get dup null eq { pop [0 0] } if" \
+  " { 1 index ( ) writestring 1 index exch round cvi 16 string cvs writestring } forall" \
+  " dup (\\n) writestring flushfile } if } bind >> setpagedevice" \
+  " /setpagedevice { dup /PageSize known" \
+  " { dup /PageSize get userdict exch /psdim_req exch put" fix " } if" \
+  " //systemdict /setpagedevice get exec } bind def"
+
+static char pagesize_prelude[] = PAGESIZE_PRELUDE("%stderr", "");
+
+/* the same for the server's pool, which has no -dFIXEDMEDIA, since
+   it sets the canvas for each document: the page size is taken out
+   of the request instead. The reports are written to standard
+   output, between the pages. */
+
+char serve_prelude[] = PAGESIZE_PRELUDE("%stdout", " dup length dict copy dup /PageSize undef");
+
+/* insert the page size prelude into the ghostscript arguments from
+   gs_args, with argc arguments, before the final "-", and fix the
+   media. Return the new number of arguments. */
+
+int gs_pagesize(char *argv[], int argc) {
+  argc--;  /* the final "-" */
+  argv[argc++] = "-dFIXEDMEDIA";
+  argv[argc++] = "-c";
+  argv[argc++] = pagesize_prelude;
+  argv[argc++] = "-f";
+  argv[argc++] = "-";
+  argv[argc] = NULL;
+  return argc;
+}
+
+/* do the ghostscript arguments argv contain the page size prelude? */
+
+int has_pagesize(char *argv[]) {
+  int i;
+
+  for (i=0; argv[i]; i++) {
+    if (argv[i] == pagesize_prelude) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* the side channel of the page size prelude: its file descriptor
+   (or -1, if the reports are passed to side_write by other means),
+   the part of its last line that has been read so far, and the
+   queue of the page heights reported, but not yet taken */
+static int sidefd = -1;
+static char sidebuf[BUFSIZ];
+static int sidelen = 0;
+static double *sideq = NULL;
+static int sidehead = 0, sidecount = 0, sidealloc = 0;
+
+/* start reading the reports of a new ghostscript from the side
+   channel fd, which holds its standard error, or from side_write if
+   fd is -1 */
+
+void side_open(int fd) {
+  sidefd = fd;
+  sidelen = 0;
+  sidehead = sidecount = 0;
+}
+
+/* take len bytes of the side channel. The reports of the page size
+   prelude, lines "%%psdim-page <w> <h>", are queued; anything else
+   ghostscript writes there is passed on to stderr. Return 0 on
+   success, or -1 with merrno set. */
+
+int side_write(const char *buf, size_t len) {
+  char *nl, *line;
+  double *q, w, h;
+  size_t k;
+
+  while (len > 0) {
+    k = sizeof(sidebuf) - sidelen < len ? sizeof(sidebuf) - sidelen : len;
+    memcpy(sidebuf + sidelen, buf, k);
+    sidelen += k;
+    buf += k;
+    len -= k;
+    while ((nl = memchr(sidebuf, '\n', sidelen)) != NULL) {
+      *nl = 0;
+      line = sidebuf;
+      if (strncmp(line, "%%psdim-page ", 13) == 0
+	  && sscanf(line+13, "%lf %lf", &w, &h) == 2) {
+	if (sidecount == sidealloc) {
+	  sidealloc = sidealloc ? 2*sidealloc : 64;
+	  q = (double *)realloc(sideq, sidealloc * sizeof(double));
+	  if (!q) {
+	    merrno = ME_MEM;
+	    return -1;
 	  }
+	  sideq = q;
 	}
+	sideq[sidecount++] = h;
+      } else {
+	fprintf(stderr, "%s\n", line);
       }
+      sidelen -= nl+1 - sidebuf;
+      memmove(sidebuf, nl+1, sidelen);
+    }
+    if (sidelen == sizeof(sidebuf)) {
+      /* too long for a report */
+      fwrite(sidebuf, 1, sidelen, stderr);
+      sidelen = 0;
     }
+  }
+  return 0;
+}
+
+/* read whatever can be read from the side channel without waiting.
+   Return 1 once ghostscript has closed it (or it cannot be read), 0
+   if there may be more, or -1 with merrno set. */
 
-    if (!info.quiet) {
-      c += fprintf(stderr, "[%d] ", p);
-      if (c >= 75) {
-	fprintf(stderr, "\n");
-	c = 0;
+int side_drain(void) {
+  char buf[BUFSIZ];
+  ssize_t r;
+
+  if (sidefd == -1) {
+    return 1;
+  }
+  while (1) {
+    r = read(sidefd, buf, sizeof(buf));
+    if (r > 0) {
+      if (side_write(buf, r)) {
+	return -1;
       }
+      continue;
+    }
+    if (r == -1 && errno == EINTR) {
+      continue;
     }
+    return r == -1 && errno == EAGAIN ? 0 : 1;
+  }
+}
 
-    j = (j+1) % n;
-    p++;
-  } /* while(1) */
+/* take the report of the next page from the side channel, and store
+   the height it asked for in *h, in points, or 0 if it asked for
+   none. The report of a page is written before the page, so it is
+   never waited for. Return 0 if the page reported, else -1. */
 
- eof_error:
-  pclose(f);
-  if (!info.quiet && c!=0) {
-    fprintf(stderr, "\n");
+int side_pagesize(double *h) {
+  if (side_drain() < 0 || sidehead == sidecount) {
+    return -1;
   }
-  merrno = ME_EOF;
-  return -1;
+  *h = sideq[sidehead++];
+  if (sidehead == sidecount) {
+    sidehead = sidecount = 0;
+  }
+  return 0;
+}
 
- format_error:
-  pclose(f);
-  if (!info.quiet && c!=0) {
-    fprintf(stderr, "\n");
+/* pass on whatever is left on the side channel, until ghostscript
+   closes it, and close it. Reports that were not taken are dropped. */
+
+void side_close(void) {
+  if (sidefd != -1) {
+    fcntl(sidefd, F_SETFL, 0);
+    side_drain();
+    close(sidefd);
+    sidefd = -1;
   }
-  merrno = ME_POSTSCRIPT;
-  return -1;
-  
- eof:
-  if (!info.quiet && c!=0) {
+  if (sidelen > 0) {
+    fwrite(sidebuf, 1, sidelen, stderr);
+    sidelen = 0;
+  }
+  sidehead = sidecount = 0;
+}
+
+/* wait until there is something to read from fd, reading the side
+   channel in the meantime, so that ghostscript is not stalled by a
+   full pipe on its standard error while it writes a page */
+
+static void side_wait(int fd) {
+  struct pollfd fds[2];
+  int n = 2;
+
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = sidefd;
+  fds[1].events = POLLIN;
+  while (1) {
+    if (poll(fds, n, -1) == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return;
+    }
+    if (n == 2 && fds[1].revents && side_drain() != 0) {
+      n = 1;  /* closed, or unreadable */
+    }
+    if (fds[0].revents) {
+      return;
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+/* reading rasters */
+
+static int progress_col = 0;  /* column of stderr output */
+
+/* report that page p was processed */
+void progress_page(int p) {
+  if (!info.quiet) {
+    progress_col += fprintf(stderr, "[%d] ", p);
+    if (progress_col >= 75) {
+      fprintf(stderr, "\n");
+      progress_col = 0;
+    }
+  }
+}
+
+/* finish the line of progress output, if any */
+void progress_done(void) {
+  if (!info.quiet && progress_col != 0) {
     fprintf(stderr, "\n");
+    progress_col = 0;
+  }
+}
+
+/* read the next page of a stream of portable bitmaps (P4), graymaps
+   (P5) or pixmaps (P6) from f into pg, growing its buffer as needed,
+   along with its report on the side channel, if one is open (then f
+   must be unbuffered). Return 1 if a page was read, 0 at the end of
+   the stream, or -1 with merrno set. */
+
+int pnm_read(FILE *f, pnmpage_t *pg) {
+  int magic[2];
+  int maxval;
+  unsigned char *data;
+  size_t got;
+  ssize_t r;
+
+  if (sidefd != -1) {
+    side_wait(fileno(f));
+  }
+  magic[0] = fgetc(f);
+  if (magic[0] == EOF) {
+    return 0;
+  }
+  if (magic[0] != 'P') {
+    goto format_error;
+  }
+  magic[1] = fgetc(f);
+  if (magic[1] != '4' && magic[1] != '5' && magic[1] != '6') {
+    goto format_error;
   }
-  pclose(f);
 
-  /* figure out bounding boxes from row/column counts for each page set */
+  pg->w = readnum(f);
+  if (pg->w<0) {
+    goto format_error;
+  }
+  pg->h = readnum(f);
+  if (pg->h<0) {
+    goto format_error;
+  }
 
-  for (j=0; j<n; j++) {
-    count = 0;   /* total pixels this page */
-    for (i=0; i<1008; i++) {
-      count += rowcount[j][i];
+  if (magic[1] == '4') {
+    pg->bpp = 0;
+    pg->bpr = 1+(pg->w-1)/8;
+  } else {
+    maxval = readnum(f);
+    if (maxval<1 || maxval>=65536) {
+      goto format_error;
     }
-    if (count == 0) { /* no pixels */
-      bboxes[j].x0 = 1008;
-      bboxes[j].y0 = 1008;
-      bboxes[j].x1 = 0;
-      bboxes[j].y1 = 0;
-    } else {
-      /* percentiles */
-      px0 = (int)floor(count * percentile->x0);
-      px1 = (int)ceil(count * percentile->x1);
-      py0 = (int)floor(count * percentile->y0);
-      py1 = (int)ceil(count * percentile->y1);
+    pg->bpp = (maxval >= 256) ? 2 : 1;   /* bytes per pixel */
+    if (magic[1] == '6') {
+      pg->bpp *= 3;
+    }
+    pg->bpr = pg->w * pg->bpp;
+  }
+  pg->size = (size_t)pg->bpr * pg->h;
 
-      count = 0;
-      bboxes[j].x0 = 0;
-      bboxes[j].x1 = 0;
-      for (i=0; i<1008; i++) {
-	count += colcount[j][i];
-	if (count <= px0) {
-	  bboxes[j].x0 = i+1;
-	}
-	if (count < px1) {
-	  bboxes[j].x1 = i+2;
-	}
-      }
-      count = 0;
-      bboxes[j].y0 = 0;
-      bboxes[j].y1 = 0;
-      for (i=0; i<1008; i++) {
-	count += rowcount[j][i];
-	if (count <= py0) {
-	  bboxes[j].y0 = i+1;
-	}
-	if (count < py1) {
-	  bboxes[j].y1 = i+2;
-	}
-      }
+  if (pg->size > pg->datalen) {
+    data = (unsigned char *)realloc(pg->data, pg->size);
+    if (!data) {
+      merrno = ME_MEM;
+      return -1;
+    }
+    pg->data = data;
+    pg->datalen = pg->size;
+  }
+  if (sidefd == -1) {
+    if (fread(pg->data, 1, pg->size, f) != pg->size) {
+      merrno = ME_EOF;
+      return -1;
     }
+    pg->sized = 0;
+    return 1;
   }
 
-  /* handle the special case of certain PostScript files produced by
-     Acrobat Reader that anchor the page in the top left corner of the
-     canvas, instead of the bottom left corner. The only way to detect
-     this for sure would be to render the image twice. Here we use a
-     heuristic. */
-  top = 0;
-  bot = 1008;
-  for (i=0; i<1008; i++) {
-    for (j=0; j<n; j++) {
-      if (rowcount[j][i] != 0) {
-        top = i;
-        if (bot == 1008) {
-          bot = i;
-        }
+  /* ghostscript may write to the side channel before the page is
+     through the pipe */
+  for (got = 0; got < pg->size; got += r) {
+    side_wait(fileno(f));
+    r = read(fileno(f), pg->data + got, pg->size - got);
+    if (r == -1 && errno == EINTR) {
+      r = 0;
+    } else if (r <= 0) {
+      merrno = ME_EOF;
+      return -1;
+    }
+  }
+  pg->sized = side_pagesize(&pg->height) == 0;
+  return 1;
+
+ format_error:
+  merrno = ME_POSTSCRIPT;
+  return -1;
+}
+
+/* add the page pg, which is page number page (counting from 0) of
+   the document, to hist, and report it. For graymaps and pixmaps,
+   pixels that differ from the first (top left) pixel count as ink. Return 0 on
+   success, or -1 with merrno set. */
+
+int hist_page(hist_t *hist, int page, pnmpage_t *pg) {
+  pagestat_t stat, *st;
+  long long *rowcount, *colcount;
+  unsigned char *rowmax, *colmax;
+  int r, sized, cw;
+
+  if (hist->grow && hist_grow(hist, pg->w, pg->h)) {
+    return -1;
+  }
+  st = hist->perpage ? &stat : NULL;
+
+  /* the page size it asked for, if reported */
+  sized = pg->sized;
+  if (sized) {
+    hist->anchor = 0;
+  }
+
+  if (hist->keep || sized) {
+    /* count the page by itself first */
+    if (!hist->scratch) {
+      hist->scratch = (long long *)malloc(((size_t)hist->h + hist->w) * sizeof(long long));
+      hist->scratchmax = (unsigned char *)malloc((size_t)hist->h + hist->w);
+      if (!hist->scratch || !hist->scratchmax) {
+	free(hist->scratch);
+	free(hist->scratchmax);
+	hist->scratch = NULL;
+	hist->scratchmax = NULL;
+	merrno = ME_MEM;
+	return -1;
       }
     }
+    memset(hist->scratch, 0, ((size_t)hist->h + hist->w) * sizeof(long long));
+    memset(hist->scratchmax, 0, (size_t)hist->h + hist->w);
+    rowcount = hist->scratch;
+    colcount = hist->scratch + hist->h;
+    rowmax = hist->scratchmax;
+    colmax = hist->scratchmax + hist->h;
+  } else {
+    rowcount = hist->rowcount + (size_t)(page % hist->n)*hist->h;
+    colcount = hist->colcount + (size_t)(page % hist->n)*hist->w;
+    rowmax = hist->rowmax + (size_t)(page % hist->n)*hist->h;
+    colmax = hist->colmax + (size_t)(page % hist->n)*hist->w;
   }
-  if (top >= 842 && bot > 1008-842) {
-    for (j=0; j<n; j++) {
-      bboxes[j].y0 -= 1008 - 792;
-      bboxes[j].y1 -= 1008 - 792;
+  /* the padding at the end of the rows of a bitmap need not be blank */
+  cw = pg->w < hist->w ? pg->w : hist->w;
+  if (hist->gray && pg->bpp == 1) {
+    r = gray_coverage(pg->data, pg->bpr, pg->w, pg->h, hist->w, hist->h,
+		      rowcount, colcount, rowmax, colmax, st);
+  } else if (hist->threshold >= 0 && pg->bpp == 1) {
+    r = gray_histogram(pg->data, pg->bpr, pg->w, pg->h, hist->threshold, hist->w, hist->h,
+		       rowcount, colcount, st);
+  } else if (pg->bpp) {
+    r = rgb_histogram(pg->data, pg->bpr, pg->w, pg->h, pg->bpp, hist->w, hist->h,
+		      rowcount, colcount, st);
+  } else if (hist->exact) {
+    r = p4_extent(pg->data, pg->bpr, pg->h, cw, hist->h, rowcount, colcount, st);
+  } else {
+    r = p4_histogram(pg->data, pg->bpr, pg->h, cw, hist->h, rowcount, colcount, st);
+  }
+  if (r) {
+    merrno = ME_MEM;
+    return -1;
+  }
+  if (sized) {
+    hist_shift(hist, pg->height, st);
+  }
+  if (hist->keep && hist_keep(hist, page)) {
+    return -1;
+  }
+  if (hist->keep || sized) {
+    hist_add(hist, page);
+  }
+  if (st) {
+    st->page = page+1;
+    if (hist->res != 72) {
+      pixels_to_points(&st->x0, &st->y0, &st->x1, &st->y1, hist->res);
+    }
+    perpage_page(st);
+  }
+  progress_page(page+1);
+  return 0;
+}
+
+/* read zero or more portable bitmaps (P4), graymaps (P5) or pixmaps
+   (P6) from f, and add them to hist. The first page read is page
+   number first (counting from 0) of the document. Return the number of pages
+   read, or -1 with merrno set. */
+
+int read_pnm(FILE *f, hist_t *hist, int first) {
+  static pnmpage_t pg;  /* keeps its buffer from call to call */
+  int pages, r;
+
+#ifdef HAVE_LIBPTHREAD
+  if (info.pipeline) {
+    return pipeline_read_pnm(f, hist, first);
+  }
+#endif
+  for (pages=0; ; pages++) {
+    r = pnm_read(f, &pg);
+    if (r <= 0) {
+      return r < 0 ? -1 : pages;
+    }
+    if (hist_page(hist, first+pages, &pg)) {
+      return -1;
     }
   }
+}
+
+/* run ghostscript with the arguments argv from gs_args, with its
+   standard input connected to fdin (or inherited, if fdin is -1),
+   and add the pages it renders to hist, using the raster transport
+   chosen with --transport. fdin is closed once ghostscript has
+   been started. The first page is page number first (counting from
+   0) of the document. Return the number of pages rendered, or -1
+   with merrno set. */
+
+int gs_render(char *argv[], int fdin, hist_t *hist, int first) {
+  FILE *f;
+  pid_t pid;
+  int r, side = -1;
+
+  if (info.transport == TRANSPORT_SHM) {
+    return shm_render(argv, fdin, hist, first);
+  }
+  f = gs_spawn(argv, fdin, 1, has_pagesize(argv) ? &side : NULL, &pid);
+  if (fdin != -1) {
+    close(fdin);
+  }
+  if (!f) {
+    return -1;
+  }
+  if (side != -1) {
+    /* pnm_read waits for both pipes itself */
+    setvbuf(f, NULL, _IONBF, 0);
+    side_open(side);
+  }
+  r = read_pnm(f, hist, first);
+  /* after an error, ghostscript may still be writing pages */
+  if (side != -1 && r >= 0) {
+    side_close();
+  }
+  if (gs_close(f, pid)) {
+    r = -1;
+  }
+  if (side != -1 && r < 0) {
+    side_close();
+  }
+  return r;
+}
+
+/* connect infile to stdin, unless infile is NULL. Return 0 on
+   success, or -1 with merrno set. */
+
+int connect_stdin(char *infile) {
+  int fdin, r;
+  struct stat st;
+
+  if (!infile) {
+    return 0;
+  }
+  /* open infile */
+  fdin = open(infile, O_RDONLY);
+  if (fdin == -1) {
+    merrno = ME_IO;
+    return -1;
+  }
+  /* check that it's not a directory */
+  fstat(fdin, &st);
+  if (S_ISDIR(st.st_mode)) {
+    close(fdin);
+    errno = EISDIR;
+    merrno = ME_IO;
+    return -1;
+  }
+  r = dup2(fdin, 0);
+  close(fdin);
+  if (r == -1) {
+    merrno = ME_IO;
+    return -1;
+  }
+  return 0;
+}
+
+/* is the file open on fd a PDF document? */
+
+int is_pdf(int fd) {
+  char magic[4];
+
+  return pread(fd, magic, 4, 0) == 4 && strncmp(magic, "%PDF", 4) == 0;
+}
+
+/* make infile the input of ghostscript, whose arguments argv, with
+   argc arguments, end in "-". A PDF document is passed by name, since
+   ghostscript needs to seek in it; any other document is connected
+   to stdin, as by connect_stdin. argv must have room for one more
+   argument. Return 0 on success, or -1 with merrno set. */
+
+int gs_input(char *argv[], int argc, char *infile) {
+  int fd, pdf;
+
+  if (!infile) {
+    return 0;
+  }
+  fd = open(infile, O_RDONLY);
+  if (fd == -1) {
+    merrno = ME_IO;
+    return -1;
+  }
+  pdf = is_pdf(fd);
+  close(fd);
+  if (!pdf) {
+    return connect_stdin(infile);
+  }
+  argv[argc-1] = "-dBATCH";
+  argv[argc++] = infile;
+  argv[argc] = NULL;
   return 0;
 }
 
+/* render the document infile (or stdin, if infile is NULL) in a
+   single ghostscript process (or in-process, if psdim is linked with
+   libgs, or in a ghostscript of the server's pool, if it can be),
+   and add its pages to hist. Return 0 on success, or -1 with merrno
+   set. */
+
+static int render(char *infile, int color, hist_t *hist) {
+#ifndef HAVE_LIBGS
+  char *argv[GS_ARGS];
+  int argc;
+#endif
+  int r;
+
+  if (serve_warm(infile, color)) {
+    if (serve_render(infile, hist) >= 0) {
+      return 0;
+    }
+    if (merrno != ME_EOF) {
+      return -1;
+    }
+    /* the document stopped ghostscript; render it by itself */
+    hist_clear(hist);
+  }
+#ifdef HAVE_LIBGS
+  r = render_libgs(infile, color, hist);
+#else
+  argc = gs_args(argv, color);
+  argc = gs_pagesize(argv, argc);
+  if (gs_input(argv, argc, infile)) {
+    return -1;
+  }
+  r = gs_render(argv, -1, hist, 0);
+  progress_done();
+#endif
+  return r < 0 ? -1 : 0;
+}
+
+/* choose the size of the canvas on which infile (or stdin, if
+   infile is NULL) is rendered, unless it was given with --canvas:
+   the largest media size or bounding box in the document's DSC
+   header, or the largest page of a PDF document, or CANVAS x CANVAS
+   points if there is none (e.g., if stdin is a pipe). */
+
+void canvas_setup(char *infile) {
+  double w, h;
+  int fd, r;
+
+  if (info.canvas_w > 0) {
+    return;
+  }
+  info.canvas_w = info.canvas_h = CANVAS;
+  fd = infile ? open(infile, O_RDONLY) : 0;
+  if (fd == -1) {
+    return;
+  }
+  if (infile && is_pdf(fd)) {
+    r = pdf_info(infile, &w, &h) > 0 ? 0 : -1;
+  } else {
+    r = dsc_media(fd, &w, &h);
+  }
+  if (infile) {
+    close(fd);
+  }
+  if (r == 0 && w >= 1.0 && h >= 1.0 && w <= CANVAS_MAX && h <= CANVAS_MAX) {
+    info.canvas_w = (int)ceil(w);
+    info.canvas_h = (int)ceil(h);
+  }
+}
+
+/* render the document into a new histogram for n page sets, in one
+   or several ghostscript processes, and store it in *histp. If exact
+   is set, only the extent of each page need be marked. The canvas
+   must have been set up. Return 0 on success, or -1 with merrno
+   set. */
+
+static int render_hist(char *infile, int n, int color, int exact, hist_t **histp) {
+  hist_t *hist;
+  int r;
+
+  hist = hist_canvas(n, color);
+  if (!hist) {
+    return -1;
+  }
+  hist->perpage = info.perpage != NULL;
+  hist->exact = exact && !hist->perpage;
+  if ((info.sample > 0 || info.sample_fraction > 0.0) && !info.perpage) {
+    r = psdim_sample(infile, color, hist);
+  } else if (info.jobs > 1) {
+    r = psdim_jobs(infile, info.jobs, color, hist);
+  } else {
+    r = render(infile, color, hist);
+  }
+  if (r) {
+    hist_free(hist);
+    return -1;
+  }
+  *histp = hist;
+  return 0;
+}
+
+/* like render_hist, but set up the canvas first, and never make an
+   exact histogram, so that it can answer any percentiles. Return 0
+   on success, or -1 with merrno set. */
+
+int psdim_hist(char *infile, int n, int color, hist_t **histp) {
+  canvas_setup(infile);
+  return render_hist(infile, n, color, 0, histp);
+}
+
+/* render the document in a single ghostscript process into a new
+   histogram for a single page set, which keeps the counts of each
+   page, and store it in *histp. hist_regroup makes histograms for any
+   number of page sets from it. If exact is set, only the extent of
+   each page need be marked. Return 0 on success, or -1 with merrno
+   set. */
+
+int psdim_pages(char *infile, int color, int exact, hist_t **histp) {
+  hist_t *hist;
+
+  canvas_setup(infile);
+  hist = hist_canvas(1, color);
+  if (!hist) {
+    return -1;
+  }
+  hist->keep = 1;
+  hist->perpage = info.perpage != NULL;
+  hist->exact = exact && !hist->perpage;
+  if (render(infile, color, hist)) {
+    hist_free(hist);
+    return -1;
+  }
+  *histp = hist;
+  return 0;
+}
+
+/* measure the document, in one or several ghostscript processes */
+
+static int measure(char *infile, int n, bbox_t *bboxes, percentile_t *percentile, int color) {
+  hist_t *hist;
+  int exact;
+
+  canvas_setup(infile);
+
+  /* are exact bounding boxes wanted? */
+  exact = !color && percentile->x0 == 0.0 && percentile->x1 == 1.0
+    && percentile->y0 == 0.0 && percentile->y1 == 1.0;
+
+  if (info.engine == ENGINE_BBOX || (info.engine == ENGINE_AUTO && exact)) {
+    return psdim_bbox(infile, n, bboxes);
+  }
+  /* per-page records need every page rendered in full, and the
+     strips are rendered at fixed resolutions */
+  if (info.engine == ENGINE_ADAPTIVE && exact && !info.perpage
+      && info.resolution == 72) {
+    return psdim_adaptive(infile, n, bboxes);
+  }
+
+  if (render_hist(infile, n, color, exact, &hist)) {
+    return -1;
+  }
+  hist_bboxes(hist, bboxes, percentile);
+  hist_free(hist);
+  return 0;
+}
+
+/* read zero or more portable bitmaps from GS and figure out the
+   dimension of their printed area. This information is collected for
+   all pages modulo n, e.g., if n=2, the info is summarized separately
+   for even and odd pages. Return 0 on success, or -1 with merrno
+   set. */
+
+int psdim(char *infile, int n, bbox_t *bboxes, percentile_t *percentile) {
+  return measure(infile, n, bboxes, percentile, 0);
+}
+
+/* like psdim, except use colored bitmaps (or graymaps, with
+   --gray). Return 0 on error, else -1 with merrno set. NOTE: this
+   calculates the right dimensions; however, pstops does not work
+   well on colored backgrounds due to stupid cropping. */
+
+int psdim_color(char *infile, int n, bbox_t *bboxes, percentile_t *percentile) {
+  return measure(infile, n, bboxes, percentile,
+		 info.color == COLOR_GRAY ? COLOR_GRAY : COLOR_RGB);
+}
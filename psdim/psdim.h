@@ -8,9 +8,125 @@
 #ifndef PSDIM_H
 #define PSDIM_H
 
+#include <sys/types.h>
+
 #include "main.h"
 
+/* the row and column counts of a single page, trimmed to the rows
+   and columns that have any */
+struct pagehist_s {
+  int x0, y0;           /* first counted column and row */
+  int w, h;             /* number of counted columns and rows */
+  int *counts;          /* h row counts, then w column counts, or NULL if blank */
+  unsigned char *max;   /* h row and w column maxima, if the counts are coverage */
+};
+typedef struct pagehist_s pagehist_t;
+
+/* row and column counts of ink pixels, summarized separately for n
+   sets of pages. Row y of page set j is rowcount[j*h+y], where row 0
+   is the bottom one; column x is colcount[j*w+x]. If exact is set,
+   only the outermost rows and columns of each page are counted,
+   which is enough for bounding boxes without percentiles. The
+   canvas is res pixels per inch; bounding boxes are reported in
+   points. */
+struct hist_s {
+  int n;                /* number of page sets */
+  int w, h;             /* canvas width and height, in pixels */
+  long long *rowcount;  /* n*h row counts */
+  long long *colcount;  /* n*w column counts */
+  unsigned char *rowmax; /* n*h most coverage of any one pixel of each row, if gray */
+  unsigned char *colmax; /* n*w most coverage of any one pixel of each column, if gray */
+  int perpage;          /* report each page with perpage_page? */
+  int exact;            /* only mark the extent of each page? */
+  int res;              /* resolution, in pixels per inch */
+  int gray;             /* are the counts the coverage of anti-aliased pixels, 255 each? */
+  int threshold;        /* tolerance of the background of graymaps of --gray, or -1 */
+  int grow;             /* enlarge the canvas to fit each page? */
+  int anchor;           /* apply anchor_fixup? */
+  int moved;            /* pages that hist_shift moved to the bottom */
+  int keep;             /* also keep the counts of each page? */
+  pagehist_t *pages;    /* the kept counts, indexed by page number */
+  int npages;           /* number of pages kept */
+  long long *scratch;   /* h+w counts of the current page, if needed */
+  unsigned char *scratchmax; /* and its h+w maxima */
+};
+typedef struct hist_s hist_t;
+
+#define HIST_MAGIC "psdim-hist 3"  /* first line of a file written by hist_save */
+
+#define GS_ARGS 32      /* room for ghostscript arguments */
+
+#define CANVAS     1008   /* default canvas size, in points */
+#define CANVAS_MAX 14400  /* largest canvas size, in points */
+
+/* a rectangular part of the canvas, to be rendered by itself at the
+   given resolution. The sizes must be whole numbers of pixels. */
+struct window_s {
+  int x, y;             /* lower left corner, in points */
+  int w, h;             /* size, in points */
+  int res;              /* resolution, in pixels per inch */
+  int pagesize;         /* read the page sizes, as for the whole canvas? */
+  char geom[32];        /* storage for ghostscript arguments */
+  char resarg[16];
+  char prelude[80];
+};
+typedef struct window_s window_t;
+
+/* a page of a stream of portable bitmaps, graymaps or pixmaps, top
+   row first */
+struct pnmpage_s {
+  int w, h;             /* size in pixels */
+  int bpp;              /* bytes per pixel of a P5 or P6 page, or 0 for P4 */
+  int bpr;              /* bytes per row */
+  size_t size;          /* bytes of data in the page */
+  unsigned char *data;  /* the raw page data */
+  size_t datalen;       /* allocated size of data */
+  int sized;            /* did the page report the size it asked for? */
+  double height;        /* if so, its height in points, or 0 if it asked for none */
+};
+typedef struct pnmpage_s pnmpage_t;
+
 int readnum(FILE *f);
+hist_t *hist_new(int n, int w, int h);
+int canvas_pixels(int points);
+hist_t *hist_canvas(int n, int color);
+int hist_grow(hist_t *hist, int w, int h);
+void hist_free(hist_t *hist);
+void hist_clear(hist_t *hist);
+void max_merge(unsigned char *dst, unsigned char *src, size_t len);
+void hist_merge(hist_t *dst, hist_t *src);
+hist_t *hist_regroup(hist_t *hist, int n);
+void pixels_to_points(int *x0, int *y0, int *x1, int *y1, int res);
+void anchor_fixup(int n, bbox_t *bboxes, int h, int top, int bot);
+void hist_bboxes(hist_t *hist, bbox_t *bboxes, percentile_t *percentile);
+int hist_save(hist_t *hist, char *path);
+int hist_load(char *path, hist_t **histp);
+FILE *gs_open(char *argv[], int fdin, int out, pid_t *pid);
+int gs_close(FILE *f, pid_t pid);
+int gs_args(char *argv[], int color);
+int gs_window(char *argv[], int argc, window_t *win);
+int gs_pagesize(char *argv[], int argc);
+extern char serve_prelude[];
+int gs_fast(char *argv[], int argc);
+FILE *gs_spawn(char *argv[], int fdin, int out, int *side, pid_t *pid);
+int has_pagesize(char *argv[]);
+void side_open(int fd);
+int side_write(const char *buf, size_t len);
+int side_drain(void);
+int side_pagesize(double *h);
+void side_close(void);
+void progress_page(int p);
+void progress_done(void);
+int pnm_read(FILE *f, pnmpage_t *pg);
+int hist_page(hist_t *hist, int page, pnmpage_t *pg);
+int read_pnm(FILE *f, hist_t *hist, int first);
+int gs_render(char *argv[], int fdin, hist_t *hist, int first);
+int connect_stdin(char *infile);
+int is_pdf(int fd);
+int gs_input(char *argv[], int argc, char *infile);
+void canvas_setup(char *infile);
+int psdim_hist(char *infile, int n, int color, hist_t **histp);
+int psdim_pages(char *infile, int color, int exact, hist_t **histp);
 int psdim(char *infile, int n, bbox_t *bboxes, percentile_t *percentile);
 int psdim_color(char *infile, int n, bbox_t *bboxes, percentile_t *percentile);
 
@@ -0,0 +1,95 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* measuring pages that were rendered elsewhere. Instead of running
+   ghostscript, the pages are read from a stream of portable bitmaps,
+   graymaps or pixmaps, such as a raster image processor produces, of
+   any size and at the resolution given with --resolution. Each page
+   lies in the lower left corner of the canvas, which grows to fit
+   the largest page unless its size was given with --canvas. Such
+   pages are not anchored anywhere else, so the anchor heuristic for
+   PostScript files is not applied. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "raster.h"
+
+/* read the pages from file (or from stdin, if file is "-") into a new
+   histogram for n page sets, and store it in *histp. If exact is set,
+   only the extent of each page need be marked. Return 0 on success,
+   or -1 with merrno set. */
+
+int raster_hist(char *file, int n, int exact, hist_t **histp) {
+  FILE *f;
+  hist_t *hist;
+  int w, h, r;
+
+  w = h = 1;
+  if (info.canvas_w > 0) {
+    w = (int)ceil(info.canvas_w * info.resolution / 72.0);
+    h = (int)ceil(info.canvas_h * info.resolution / 72.0);
+  }
+  hist = hist_new(n, w, h);
+  if (!hist) {
+    return -1;
+  }
+  hist->res = info.resolution;
+  hist->grow = info.canvas_w == 0;
+  hist->anchor = 0;
+  hist->perpage = info.perpage != NULL;
+  hist->exact = exact && !hist->perpage;
+
+  if (strcmp(file, "-") == 0) {
+    f = stdin;
+  } else {
+    f = fopen(file, "rb");
+    if (!f) {
+      hist_free(hist);
+      merrno = ME_IO;
+      return -1;
+    }
+  }
+  r = read_pnm(f, hist, 0);
+  progress_done();
+  if (f != stdin) {
+    fclose(f);
+  }
+  if (r < 0) {
+    if (merrno == ME_POSTSCRIPT || merrno == ME_EOF) {
+      merrno = ME_RASTER;
+    }
+    hist_free(hist);
+    return -1;
+  }
+  *histp = hist;
+  return 0;
+}
+
+/* read the pages from file (or from stdin, if file is "-") and
+   figure out the dimension of their printed area, like psdim. Return
+   0 on success, or -1 with merrno set. */
+
+int psdim_raster(char *file, int n, bbox_t *bboxes, percentile_t *percentile) {
+  hist_t *hist;
+  int exact;
+
+  exact = percentile->x0 == 0.0 && percentile->x1 == 1.0
+    && percentile->y0 == 0.0 && percentile->y1 == 1.0;
+  if (raster_hist(file, n, exact, &hist)) {
+    return -1;
+  }
+  hist_bboxes(hist, bboxes, percentile);
+  hist_free(hist);
+  return 0;
+}
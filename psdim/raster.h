@@ -0,0 +1,15 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "main.h"
+#include "psdim.h"
+
+int raster_hist(char *file, int n, int exact, hist_t **histp);
+int psdim_raster(char *file, int n, bbox_t *bboxes, percentile_t *percentile);
+
+#endif /* RASTER_H */
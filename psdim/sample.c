@@ -0,0 +1,240 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* rendering a sample of the pages of a long document. The pages of
+   the document are divided into groups of n consecutive pages, one
+   from each page set, and a stratified sample of k groups is
+   rendered: the first group, the last group, and one pseudo-random
+   group from each of k-2 equal parts of the rest of the document.
+   Each page set is thus represented by k pages from all parts of the
+   document. The pages are located via the document's page index, so
+   the time taken depends on k, not on the length of the document.
+
+   Since the pages outside the sample are not looked at, the result
+   is only an estimate. Two indications of its accuracy are reported:
+   the spread, i.e., how far apart the edges of the sampled pages of
+   each page set are, and a distribution-free bound on the fraction
+   of unsampled pages that may extend beyond the sampled ones. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "jobs.h"
+#include "sample.h"
+
+/* choose k of the groups 0..groups-1, in increasing order, and store
+   them in group[]. The choice is pseudo-random, but the same on each
+   run. */
+static void choose_groups(int groups, int k, int *group) {
+  unsigned long seed = 12345;
+  int i, lo, hi, m;
+
+  group[0] = 0;
+  if (k >= 2) {
+    group[k-1] = groups-1;
+  }
+  m = groups-2;  /* number of interior groups */
+  for (i=0; i<k-2; i++) {
+    lo = 1 + (long)i*m/(k-2);
+    hi = 1 + (long)(i+1)*m/(k-2);
+    seed = seed * 1103515245 + 12345;
+    group[i+1] = lo + (int)((seed >> 16) % (hi-lo));
+  }
+}
+
+/* render the pages of groups group[0..k-1] of doc, with each page
+   in its own page set of a new histogram, which is stored in *sp.
+   Return the number of pages rendered, or -1 with merrno set. */
+static int render_sample(doc_t *doc, int n, int *group, int k, int color,
+			 int **pp, hist_t **sp) {
+  int *page;
+  int i, g, count, r;
+  hist_t *s;
+
+  page = (int *)malloc((size_t)k*n * sizeof(int));
+  if (!page) {
+    merrno = ME_MEM;
+    return -1;
+  }
+  count = 0;
+  for (i=0; i<k; i++) {
+    for (g=group[i]*n; g<group[i]*n+n && g<doc->pages; g++) {
+      page[count++] = g;
+    }
+  }
+  s = hist_canvas(count, color);
+  if (!s) {
+    free(page);
+    return -1;
+  }
+  r = render_pages(doc, page, count, color, s);
+  if (r < 0) {
+    free(page);
+    hist_free(s);
+    return -1;
+  }
+  *pp = page;
+  *sp = s;
+  return r;
+}
+
+/* find how far apart the corresponding edges of the sampled pages of
+   each page set are, in pixels. s holds count sampled pages, page
+   set j of s being page page[j] of the document. */
+static int spread(hist_t *s, int *page, int count, int n) {
+  int *lo, *hi;
+  int i, j, e, x, y, edge[4], d;
+  long long *rowcount, *colcount;
+
+  lo = (int *)malloc(4*n * sizeof(int));
+  hi = (int *)malloc(4*n * sizeof(int));
+  d = 0;
+  if (!lo || !hi) {
+    free(lo);
+    free(hi);
+    return d;
+  }
+  for (i=0; i<4*n; i++) {
+    lo[i] = s->w > s->h ? s->w : s->h;
+    hi[i] = -1;
+  }
+  for (i=0; i<count; i++) {
+    rowcount = s->rowcount + (size_t)i*s->h;
+    colcount = s->colcount + (size_t)i*s->w;
+    edge[0] = edge[2] = -1;
+    for (x=0; x<s->w; x++) {
+      if (colcount[x]) {
+	edge[0] = edge[0] == -1 ? x : edge[0];
+	edge[1] = x;
+      }
+    }
+    for (y=0; y<s->h; y++) {
+      if (rowcount[y]) {
+	edge[2] = edge[2] == -1 ? y : edge[2];
+	edge[3] = y;
+      }
+    }
+    if (edge[0] == -1) {
+      continue;  /* blank pages have no edges */
+    }
+    j = page[i] % n;
+    for (e=0; e<4; e++) {
+      lo[4*j+e] = edge[e] < lo[4*j+e] ? edge[e] : lo[4*j+e];
+      hi[4*j+e] = edge[e] > hi[4*j+e] ? edge[e] : hi[4*j+e];
+    }
+  }
+  for (i=0; i<4*n; i++) {
+    if (hi[i] - lo[i] > d) {
+      d = hi[i] - lo[i];
+    }
+  }
+  free(lo);
+  free(hi);
+  return d;
+}
+
+/* render a sample of the pages of the document infile (or stdin, if
+   infile is NULL), as set by info.sample or info.sample_fraction,
+   and add them to hist. If the document is short, or its pages
+   cannot be located, all pages are rendered. So are they if the
+   sampled pages disagree by more than info.sample_escalate points
+   (if this is not negative). Return 0 on success, or -1 with merrno
+   set. */
+
+int psdim_sample(char *infile, int color, hist_t *hist) {
+  doc_t doc;
+  int n = hist->n;
+  int *group, *page;
+  int groups, k, i, j, r, d;
+  hist_t *s;
+  size_t x;
+
+  if (doc_open(infile, &doc)) {
+    return -1;
+  }
+  groups = (doc.pages + n-1) / n;
+  if (info.sample > 0) {
+    k = info.sample;
+  } else {
+    k = (int)ceil(info.sample_fraction * groups);
+  }
+  if (k < 1) {
+    k = 1;
+  }
+
+  if (k >= groups) {
+    goto full;
+  }
+
+  group = (int *)malloc(k * sizeof(int));
+  if (!group) {
+    doc_close(&doc);
+    merrno = ME_MEM;
+    return -1;
+  }
+  choose_groups(groups, k, group);
+  r = render_sample(&doc, n, group, k, color, &page, &s);
+  free(group);
+  if (r < 0) {
+    doc_close(&doc);
+    return -1;
+  }
+  progress_done();
+  if (r != s->n) {
+    /* the page index is wrong */
+    free(page);
+    hist_free(s);
+    goto full;
+  }
+
+  /* add up the sampled pages of each page set */
+  for (i=0; i<s->n; i++) {
+    j = page[i] % n;
+    for (x=0; x<(size_t)s->h; x++) {
+      hist->rowcount[(size_t)j*hist->h+x] += s->rowcount[(size_t)i*s->h+x];
+    }
+    for (x=0; x<(size_t)s->w; x++) {
+      hist->colcount[(size_t)j*hist->w+x] += s->colcount[(size_t)i*s->w+x];
+    }
+    max_merge(hist->rowmax + (size_t)j*hist->h, s->rowmax + (size_t)i*s->h, s->h);
+    max_merge(hist->colmax + (size_t)j*hist->w, s->colmax + (size_t)i*s->w, s->w);
+  }
+  /* pages that reported their size were already moved */
+  if (!s->anchor) {
+    hist->anchor = 0;
+  }
+  d = (int)ceil(spread(s, page, s->n, n) * 72.0 / s->res);
+  free(page);
+  hist_free(s);
+
+  if (!info.quiet) {
+    fprintf(stderr, ""PSDIM": sampled %d of %d pages (%d per page set). The sampled pages\n"
+	    "differ by up to %dpt; with 95%% confidence, at most %.0f%% of the other pages\n"
+	    "extend beyond them.\n", r, doc.pages, k, d,
+	    100.0 * (1.0 - pow(0.05, 1.0/k)));
+  }
+  if (info.sample_escalate < 0 || d <= info.sample_escalate) {
+    doc_close(&doc);
+    return 0;
+  }
+  if (!info.quiet) {
+    fprintf(stderr, ""PSDIM": rendering all pages.\n");
+  }
+  hist_clear(hist);
+
+ full:
+  /* the document is still available under doc.path */
+  r = psdim_jobs(doc.path, info.jobs, color, hist);
+  doc_close(&doc);
+  return r;
+}
@@ -0,0 +1,14 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include "main.h"
+#include "psdim.h"
+
+int psdim_sample(char *infile, int color, hist_t *hist);
+
+#endif /* SAMPLE_H */
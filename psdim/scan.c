@@ -0,0 +1,885 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* histogram kernels: count the ink pixels of a rendered page by row
+   and by column. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+#if (defined(__GNUC__) && __GNUC__ >= 5 || defined(__clang__)) \
+  && (defined(__x86_64__) || defined(__i386__))
+ #define X86_DISPATCH
+ #include <immintrin.h>
+#endif
+
+/* The column counts are accumulated in bit-sliced form: each column
+   has an 8-bit vertical counter, and bit k of that counter is stored
+   in plane k, at the same bit position that the column has in a
+   row. Adding a row to all counters is then a ripple-carry addition
+   done a whole machine word (or vector register) at a time. The
+   counters are flushed into colcount before they can overflow. */
+
+#define PLANES 8
+#define FLUSH  ((1<<PLANES)-1)  /* rows that fit into the counters */
+#define VEC    64               /* widest vector size, in bytes */
+
+/* a row function adds one row of len bytes to the bit-sliced
+   counters, and returns the number of ink pixels in the row. len is
+   a multiple of VEC, and planes is VEC-aligned. Blank rows leave the
+   counters alone. */
+typedef int rowfn_t(unsigned char *planes, int len, unsigned char *row);
+
+static inline int popcount64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/* count the ink pixels of a row, 64 bits at a time. This is
+   included in each of the row functions below, so that the compiler
+   can use a popcount instruction where the target has one. */
+#define ROW_POPCOUNT(count, row, len) do {	\
+    int i_;					\
+    uint64_t x_;				\
+    (count) = 0;				\
+    for (i_=0; i_<(len); i_+=8) {		\
+      memcpy(&x_, (row)+i_, 8);			\
+      (count) += popcount64(x_);		\
+    }						\
+  } while (0)
+
+static int row_generic(unsigned char *planes, int len, unsigned char *row) {
+  int i, k, count;
+  uint64_t carry, t, *p;
+
+  ROW_POPCOUNT(count, row, len);
+  if (count == 0) {
+    return 0;
+  }
+  for (i=0; i<len; i+=8) {
+    memcpy(&carry, row+i, 8);
+    for (k=0; k<PLANES && carry; k++) {
+      p = (uint64_t *)(planes + k*len + i);
+      t = *p & carry;
+      *p ^= carry;
+      carry = t;
+    }
+  }
+  return count;
+}
+
+#ifdef X86_DISPATCH
+
+__attribute__((target("sse2")))
+static int row_sse2(unsigned char *planes, int len, unsigned char *row) {
+  int i, k, count;
+  __m128i carry, t, p, *pp;
+  __m128i zero = _mm_setzero_si128();
+
+  ROW_POPCOUNT(count, row, len);
+  if (count == 0) {
+    return 0;
+  }
+  for (i=0; i<len; i+=16) {
+    carry = _mm_loadu_si128((__m128i *)(row+i));
+    for (k=0; k<PLANES; k++) {
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(carry, zero)) == 0xffff) {
+	break;
+      }
+      pp = (__m128i *)(planes + k*len + i);
+      p = _mm_load_si128(pp);
+      t = _mm_and_si128(p, carry);
+      _mm_store_si128(pp, _mm_xor_si128(p, carry));
+      carry = t;
+    }
+  }
+  return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int row_avx2(unsigned char *planes, int len, unsigned char *row) {
+  int i, k, count;
+  __m256i carry, t, p, *pp;
+
+  ROW_POPCOUNT(count, row, len);
+  if (count == 0) {
+    return 0;
+  }
+  for (i=0; i<len; i+=32) {
+    carry = _mm256_loadu_si256((__m256i *)(row+i));
+    for (k=0; k<PLANES && !_mm256_testz_si256(carry, carry); k++) {
+      pp = (__m256i *)(planes + k*len + i);
+      p = _mm256_load_si256(pp);
+      t = _mm256_and_si256(p, carry);
+      _mm256_store_si256(pp, _mm256_xor_si256(p, carry));
+      carry = t;
+    }
+  }
+  return count;
+}
+
+__attribute__((target("avx512f,popcnt")))
+static int row_avx512(unsigned char *planes, int len, unsigned char *row) {
+  int i, k, count;
+  __m512i carry, t, p, *pp;
+
+  ROW_POPCOUNT(count, row, len);
+  if (count == 0) {
+    return 0;
+  }
+  for (i=0; i<len; i+=64) {
+    carry = _mm512_loadu_si512((void *)(row+i));
+    for (k=0; k<PLANES && _mm512_test_epi64_mask(carry, carry); k++) {
+      pp = (__m512i *)(planes + k*len + i);
+      p = _mm512_load_si512((void *)pp);
+      t = _mm512_and_si512(p, carry);
+      _mm512_store_si512((void *)pp, _mm512_xor_si512(p, carry));
+      carry = t;
+    }
+  }
+  return count;
+}
+
+#endif /* X86_DISPATCH */
+
+/* choose the widest row function the cpu supports. For testing, the
+   choice can be overridden by setting the environment variable
+   PSDIM_KERNEL to one of generic, sse2, avx2, avx512. */
+static rowfn_t *select_rowfn(void) {
+  char *k = getenv("PSDIM_KERNEL");
+
+  if (k && strcmp(k, "generic") == 0) {
+    return row_generic;
+  }
+#ifdef X86_DISPATCH
+  __builtin_cpu_init();
+  if (k && strcmp(k, "sse2") == 0) {
+    return row_sse2;
+  }
+  if (k && strcmp(k, "avx2") == 0) {
+    return row_avx2;
+  }
+  if (k && strcmp(k, "avx512") == 0) {
+    return row_avx512;
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    return row_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return row_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return row_sse2;
+  }
+#endif
+  return row_generic;
+}
+
+/* add the counters of the first nb bytes' worth of columns to
+   colcount, and clear them. */
+static void flush(unsigned char *planes, int len, int nb, long long *colcount) {
+  int i, k, bit, b;
+
+  for (k=0; k<PLANES; k++) {
+    for (i=0; i<nb; i++) {
+      b = planes[k*len + i];
+      if (b == 0) {
+	continue;
+      }
+      for (bit=0; bit<8; bit++) {
+	if (b & (0x80 >> bit)) {
+	  colcount[8*i+bit] += 1<<k;
+	}
+      }
+    }
+  }
+  memset(planes, 0, PLANES*len);
+}
+
+/* comparing a row of an RGB pixmap against the background: a cmp
+   function sets bit k%64 of diff[k/64] if byte k of row differs from
+   byte k of pat, for k < len. pat holds the background pixel,
+   repeated. diff must have room for (len+63)/64 words. */
+typedef void cmpfn_t(unsigned char *row, unsigned char *pat, int len, uint64_t *diff);
+
+/* the bytes k..len-1, one at a time */
+static void cmp_tail(unsigned char *row, unsigned char *pat, int k, int len, uint64_t *diff) {
+  for (; k<len; k++) {
+    if (k % 64 == 0) {
+      diff[k/64] = 0;
+    }
+    if (row[k] != pat[k]) {
+      diff[k/64] |= (uint64_t)1 << k % 64;
+    }
+  }
+}
+
+static void cmp_generic(unsigned char *row, unsigned char *pat, int len, uint64_t *diff) {
+  int i, k, b;
+  uint64_t x, y, d;
+
+  for (i=0; i+64<=len; i+=64) {
+    d = 0;
+    for (k=0; k<64; k+=8) {
+      memcpy(&x, row+i+k, 8);
+      memcpy(&y, pat+i+k, 8);
+      if (x == y) {
+	continue;
+      }
+      for (b=0; b<8; b++) {
+	if (row[i+k+b] != pat[i+k+b]) {
+	  d |= (uint64_t)1 << (k+b);
+	}
+      }
+    }
+    diff[i/64] = d;
+  }
+  cmp_tail(row, pat, i, len, diff);
+}
+
+#ifdef X86_DISPATCH
+
+__attribute__((target("sse2")))
+static void cmp_sse2(unsigned char *row, unsigned char *pat, int len, uint64_t *diff) {
+  int i, k;
+  uint64_t d;
+  __m128i a, b;
+
+  for (i=0; i+64<=len; i+=64) {
+    d = 0;
+    for (k=0; k<64; k+=16) {
+      a = _mm_loadu_si128((__m128i *)(row+i+k));
+      b = _mm_loadu_si128((__m128i *)(pat+i+k));
+      d |= (uint64_t)(~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xffff) << k;
+    }
+    diff[i/64] = d;
+  }
+  cmp_tail(row, pat, i, len, diff);
+}
+
+__attribute__((target("avx2")))
+static void cmp_avx2(unsigned char *row, unsigned char *pat, int len, uint64_t *diff) {
+  int i;
+  uint32_t lo, hi;
+  __m256i a, b;
+
+  for (i=0; i+64<=len; i+=64) {
+    a = _mm256_loadu_si256((__m256i *)(row+i));
+    b = _mm256_loadu_si256((__m256i *)(pat+i));
+    lo = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+    a = _mm256_loadu_si256((__m256i *)(row+i+32));
+    b = _mm256_loadu_si256((__m256i *)(pat+i+32));
+    hi = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+    diff[i/64] = (uint64_t)hi << 32 | lo;
+  }
+  cmp_tail(row, pat, i, len, diff);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void cmp_avx512(unsigned char *row, unsigned char *pat, int len, uint64_t *diff) {
+  int i;
+  __m512i a, b;
+
+  for (i=0; i+64<=len; i+=64) {
+    a = _mm512_loadu_si512((void *)(row+i));
+    b = _mm512_loadu_si512((void *)(pat+i));
+    diff[i/64] = _mm512_cmpneq_epi8_mask(a, b);
+  }
+  cmp_tail(row, pat, i, len, diff);
+}
+
+#endif /* X86_DISPATCH */
+
+/* choose the widest cmp function the cpu supports, like
+   select_rowfn */
+static cmpfn_t *select_cmpfn(void) {
+  char *k = getenv("PSDIM_KERNEL");
+
+  if (k && strcmp(k, "generic") == 0) {
+    return cmp_generic;
+  }
+#ifdef X86_DISPATCH
+  __builtin_cpu_init();
+  if (k && strcmp(k, "sse2") == 0) {
+    return cmp_sse2;
+  }
+  if (k && strcmp(k, "avx2") == 0) {
+    return cmp_avx2;
+  }
+  if (k && strcmp(k, "avx512") == 0 && __builtin_cpu_supports("avx512bw")) {
+    return cmp_avx512;
+  }
+  if (__builtin_cpu_supports("avx512bw")) {
+    return cmp_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return cmp_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return cmp_sse2;
+  }
+#endif
+  return cmp_generic;
+}
+
+static inline int ctz64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_ctzll(x);
+#else
+  int n;
+
+  for (n=0; !(x & 1); n++) {
+    x >>= 1;
+  }
+  return n;
+#endif
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* the counting of a page: rows of pixels, in bitmap form, are added
+   to the bit-sliced counters one at a time */
+struct acc_s {
+  int nb, len;           /* bytes per row in use, and padded to VEC */
+  int rows;              /* rows in the counters since the last flush */
+  unsigned char *row;    /* the current row */
+  unsigned char *any;    /* the union of the rows so far */
+  unsigned char *planes; /* the counters */
+  unsigned char *extra;  /* scratch space for the caller */
+  long long *rowcount, *colcount;
+  pagestat_t *st;
+};
+typedef struct acc_s acc_t;
+
+static rowfn_t *rowfn = NULL;
+static unsigned char *buf = NULL;  /* row, union of the rows, planes, extra */
+static size_t buflen = 0;
+
+/* start counting a page with rows of nb bytes, on a canvas of cw x
+   ch pixels. The caller gets extra bytes of scratch space, aligned
+   to VEC. Return 0 on success, or -1 if out of memory. */
+static int acc_start(acc_t *a, int nb, int cw, int ch, size_t extra,
+		     long long *rowcount, long long *colcount, pagestat_t *st) {
+  size_t size;
+
+  if (!rowfn) {
+    rowfn = select_rowfn();
+  }
+  if (st) {
+    st->x0 = cw;
+    st->y0 = ch;
+    st->x1 = 0;
+    st->y1 = 0;
+    st->ink = 0;
+  }
+  a->nb = nb;
+  a->len = (nb+VEC-1) / VEC * VEC;
+  a->rows = 0;
+  a->rowcount = rowcount;
+  a->colcount = colcount;
+  a->st = st;
+
+  /* two rows and PLANES planes, aligned to VEC, then the extra space */
+  extra = (extra+VEC-1) / VEC * VEC;
+  size = (PLANES+2)*a->len + extra;
+  if (buflen < size) {
+    free(buf);
+    buflen = 0;
+    buf = (unsigned char *)malloc(size + VEC);
+    if (!buf) {
+      return -1;
+    }
+    buflen = size;
+  }
+  a->row = buf + (VEC - (uintptr_t)buf % VEC);
+  a->any = a->row + a->len;
+  a->planes = a->any + a->len;
+  a->extra = a->planes + PLANES*a->len;
+  memset(a->row, 0, (PLANES+2)*a->len);
+  return 0;
+}
+
+/* add the row a->row, which is row y of the page, to the counts. The
+   rows must come top to bottom. */
+static void acc_row(acc_t *a, int y) {
+  int i, count;
+
+  count = rowfn(a->planes, a->len, a->row);
+  if (count == 0) {
+    return;
+  }
+  a->rowcount[y] += count;
+  if (a->st) {
+    a->st->ink += count;
+    a->st->y0 = y;
+    if (a->st->y1 == 0) {
+      a->st->y1 = y+1;
+    }
+    for (i=0; i<a->nb; i++) {
+      a->any[i] |= a->row[i];
+    }
+  }
+  a->rows++;
+  if (a->rows == FLUSH) {
+    flush(a->planes, a->len, a->nb, a->colcount);
+    a->rows = 0;
+  }
+}
+
+/* finish counting a page */
+static void acc_end(acc_t *a) {
+  pagestat_t *st = a->st;
+  unsigned char *any = a->any;
+  int i;
+
+  if (a->rows) {
+    flush(a->planes, a->len, a->nb, a->colcount);
+  }
+
+  /* the columns of the page's ink */
+  if (st && st->ink) {
+    for (i=0; any[i] == 0; i++) {
+    }
+    for (st->x0 = 8*i; !(any[i] & (0x80 >> st->x0 % 8)); st->x0++) {
+    }
+    for (i=a->nb-1; any[i] == 0; i--) {
+    }
+    for (st->x1 = 8*i+8; !(any[i] & (0x80 >> (st->x1-1) % 8)); st->x1--) {
+    }
+  }
+}
+
+/* add the ink pixels of a raw P4 page of h rows of bpr bytes to
+   rowcount and colcount. The first row of the page is the top one.
+   Only pixels inside the canvas of cw x ch pixels (measured from the
+   bottom left corner) are counted. If st is not NULL, also store the
+   page's own statistics there. Return 0 on success, or -1 if out of
+   memory. */
+
+int p4_histogram(unsigned char *page, int bpr, int h, int cw, int ch,
+		 long long *rowcount, long long *colcount, pagestat_t *st) {
+  acc_t a;
+  int nb, y, r;
+  unsigned char lastmask;
+
+  /* only bytes starting inside the canvas are looked at */
+  nb = (cw+7)/8;
+  if (nb > bpr) {
+    nb = bpr;
+  }
+  lastmask = 0xff;
+  if (nb == (cw+7)/8 && cw % 8) {
+    lastmask = 0xff << (8 - cw % 8);
+  }
+  if (acc_start(&a, nb, cw, ch, 0, rowcount, colcount, st)) {
+    return -1;
+  }
+  if (nb == 0) {
+    return 0;
+  }
+
+  for (r=0; r<h; r++) {
+    y = h-1-r;
+    if (y >= ch) {
+      continue;
+    }
+    memcpy(a.row, page + (size_t)r*bpr, nb);
+    a.row[nb-1] &= lastmask;
+    acc_row(&a, y);
+  }
+  acc_end(&a);
+  return 0;
+}
+
+static cmpfn_t *cmpfn = NULL;
+
+/* add the ink pixels of a gray or RGB page of h rows of bpr bytes (w
+   pixels of bpp bytes each; bpp is 1 or 3 for 8-bit and 2 or 6 for
+   16-bit samples) to rowcount and colcount. Pixels that differ from
+   the first (top left) pixel count as ink. Each row is compared
+   against the background a vector at a time, and turned into a row
+   of a bitmap, which is then counted like a P4 row. Otherwise like
+   p4_histogram. */
+
+int rgb_histogram(unsigned char *page, int bpr, int w, int h, int bpp, int cw, int ch,
+		  long long *rowcount, long long *colcount, pagestat_t *st) {
+  acc_t a;
+  int x, y, r, i, k, e, cols, len, words;
+  uint64_t d, *diff;
+  unsigned char *pat;
+
+  if (!cmpfn) {
+    cmpfn = select_cmpfn();
+  }
+  cols = w < cw ? w : cw;
+  if (cols < 0 || h <= 0) {
+    cols = 0;
+  }
+  len = cols*bpp;             /* bytes compared per row */
+  words = (len+63)/64;
+  if (acc_start(&a, (cols+7)/8, cw, ch, (size_t)len + 8*words,
+		rowcount, colcount, st)) {
+    return -1;
+  }
+  if (cols == 0) {
+    return 0;
+  }
+  pat = a.extra;
+  diff = (uint64_t *)(a.extra + (len+VEC-1) / VEC * VEC);
+  for (i=0; i<len; i++) {
+    pat[i] = page[i % bpp];
+  }
+
+  for (r=0; r<h; r++) {
+    y = h-1-r;
+    if (y >= ch) {
+      continue;
+    }
+    cmpfn(page + (size_t)r*bpr, pat, len, diff);
+    memset(a.row, 0, a.nb);
+    for (i=0; i<words; i++) {
+      d = diff[i];
+      while (d) {
+	k = 64*i + ctz64(d);
+	x = k / bpp;
+	a.row[x/8] |= 0x80 >> x % 8;
+	/* skip the other bytes of this pixel */
+	e = (x+1)*bpp - 64*i;
+	if (e >= 64) {
+	  break;
+	}
+	d &= ~(uint64_t)0 << e;
+      }
+    }
+    acc_row(&a, y);
+  }
+  acc_end(&a);
+  return 0;
+}
+
+/* add the ink pixels of a page of 8-bit gray pixels, h rows of bpr
+   bytes of which the first w are used, to rowcount and colcount. The
+   background is the gray level within threshold of which most pixels
+   of the page lie, and pixels that differ from it by more than
+   threshold count as ink, so that neither a colored background nor
+   the noise of a scanned or JPEG compressed one does. Each row is turned into a row of a bitmap,
+   which is then counted like a P4 row. Otherwise like
+   p4_histogram. */
+
+int gray_histogram(unsigned char *page, int bpr, int w, int h, int threshold, int cw, int ch,
+		   long long *rowcount, long long *colcount, pagestat_t *st) {
+  acc_t a;
+  long long freq[256], sum[257], best, near;
+  unsigned char ink[256];
+  unsigned char *p;
+  int x, y, r, v, lo, hi, bg, cols;
+
+  cols = w < cw ? w : cw;
+  if (cols < 0 || h <= 0) {
+    cols = 0;
+  }
+  if (acc_start(&a, (cols+7)/8, cw, ch, 0, rowcount, colcount, st)) {
+    return -1;
+  }
+  if (cols == 0) {
+    return 0;
+  }
+
+  /* the background level; white, if that does as well as any */
+  memset(freq, 0, sizeof(freq));
+  for (r=0; r<h; r++) {
+    if (h-1-r >= ch) {
+      continue;
+    }
+    p = page + (size_t)r*bpr;
+    for (x=0; x<cols; x++) {
+      freq[p[x]]++;
+    }
+  }
+  sum[0] = 0;
+  for (v=0; v<256; v++) {
+    sum[v+1] = sum[v] + freq[v];
+  }
+  bg = 255;
+  best = -1;
+  for (v=255; v>=0; v--) {
+    lo = v - threshold < 0 ? 0 : v - threshold;
+    hi = v + threshold > 255 ? 255 : v + threshold;
+    near = sum[hi+1] - sum[lo];
+    if (near > best) {
+      best = near;
+      bg = v;
+    }
+  }
+  for (v=0; v<256; v++) {
+    ink[v] = abs(v - bg) > threshold;
+  }
+
+  for (r=0; r<h; r++) {
+    y = h-1-r;
+    if (y >= ch) {
+      continue;
+    }
+    p = page + (size_t)r*bpr;
+    memset(a.row, 0, a.nb);
+    for (x=0; x<cols; x++) {
+      if (ink[p[x]]) {
+	a.row[x/8] |= 0x80 >> x % 8;
+      }
+    }
+    acc_row(&a, y);
+  }
+  acc_end(&a);
+  return 0;
+}
+
+/* add the coverage of an anti-aliased page of 8-bit gray pixels, h
+   rows of bpr bytes of which the first w are used, to rowcount and
+   colcount. A pixel of value v covers 255-v, so a fully inked pixel
+   counts 255 and a white one nothing. rowmax and colmax are raised to
+   the most coverage of any one pixel of each row and column, which
+   tells how far the ink reaches into the pixels at its edges. The page
+   statistics count the pixels with any coverage. Otherwise like
+   p4_histogram. Such pages are rendered at low resolutions, so the
+   pixels are simply added up one at a time. */
+
+int gray_coverage(unsigned char *page, int bpr, int w, int h, int cw, int ch,
+		  long long *rowcount, long long *colcount,
+		  unsigned char *rowmax, unsigned char *colmax, pagestat_t *st) {
+  unsigned char *p;
+  long long sum;
+  int x, y, r, c, cols, ink, max;
+
+  if (st) {
+    st->x0 = cw;
+    st->y0 = ch;
+    st->x1 = 0;
+    st->y1 = 0;
+    st->ink = 0;
+  }
+  cols = w < cw ? w : cw;
+  for (r=0; r<h && cols>0; r++) {
+    y = h-1-r;
+    if (y >= ch) {
+      continue;
+    }
+    p = page + (size_t)r*bpr;
+    sum = 0;
+    ink = 0;
+    max = 0;
+    for (x=0; x<cols; x++) {
+      c = 255 - p[x];
+      if (c == 0) {
+	continue;
+      }
+      colcount[x] += c;
+      if (c > colmax[x]) {
+	colmax[x] = c;
+      }
+      max = c > max ? c : max;
+      sum += c;
+      ink++;
+      if (st) {
+	st->x0 = x < st->x0 ? x : st->x0;
+	st->x1 = x+1 > st->x1 ? x+1 : st->x1;
+      }
+    }
+    if (sum == 0) {
+      continue;
+    }
+    rowcount[y] += sum;
+    if (max > rowmax[y]) {
+      rowmax[y] = max;
+    }
+    if (st) {
+      st->ink += ink;
+      st->y0 = y;
+      if (st->y1 == 0) {
+	st->y1 = y+1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* exact extents */
+
+/* x1list[n] is the index of the leftmost bit in the binary
+   representation of n. x2list[n] is the index of the rightmost
+   bit. */
+
+static const unsigned char x1list[] = { 8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 
+		 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 
+		 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 
+		 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 
+		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, }; 
+
+static const unsigned char x2list[] = { 0, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 2, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 1, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 2, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 3, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, 
+		 4, 8, 7, 8, 6, 8, 7, 8, 5, 8, 7, 8, 6, 8, 7, 8, };
+
+/* return byte i of a row of nb bytes, whose last byte is masked with
+   lastmask */
+static inline int row_byte(unsigned char *row, int i, int nb, unsigned char lastmask) {
+  return i == nb-1 ? row[i] & lastmask : row[i];
+}
+
+/* is the row of nb bytes blank? */
+static int row_blank(unsigned char *row, int nb, unsigned char lastmask) {
+  uint64_t x;
+  int i;
+
+  for (i=0; i+8<nb; i+=8) {
+    memcpy(&x, row+i, 8);
+    if (x) {
+      return 0;
+    }
+  }
+  for (; i<nb; i++) {
+    if (row_byte(row, i, nb, lastmask)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* like p4_histogram, but only find the extent of the ink, and count
+   just its outermost rows and columns, once each. This gives the
+   same bounding boxes when no percentiles are used. The topmost and
+   bottommost inked rows are found first; the rows in between are
+   only searched outside of the extent found so far, a word at a time,
+   so that the work done grows with the perimeter of the ink rather
+   than with its area. The number of ink pixels is not counted. */
+
+int p4_extent(unsigned char *page, int bpr, int h, int cw, int ch,
+	      long long *rowcount, long long *colcount, pagestat_t *st) {
+  int nb, r, top, bot, i, lim, b, x, x0, x1;
+  unsigned char lastmask, *row;
+  uint64_t w;
+
+  if (st) {
+    st->x0 = cw;
+    st->y0 = ch;
+    st->x1 = 0;
+    st->y1 = 0;
+    st->ink = -1;
+  }
+  nb = (cw+7)/8;
+  if (nb > bpr) {
+    nb = bpr;
+  }
+  lastmask = 0xff;
+  if (nb == (cw+7)/8 && cw % 8) {
+    lastmask = 0xff << (8 - cw % 8);
+  }
+  if (nb <= 0) {
+    return 0;
+  }
+
+  /* the rows inside the canvas are h-ch..h-1 */
+  top = h > ch ? h-ch : 0;
+  while (top < h && row_blank(page + (size_t)top*bpr, nb, lastmask)) {
+    top++;
+  }
+  if (top == h) {
+    return 0;
+  }
+  bot = h-1;
+  while (row_blank(page + (size_t)bot*bpr, nb, lastmask)) {
+    bot--;
+  }
+
+  x0 = 8*nb;
+  x1 = 0;
+  for (r=top; r<=bot; r++) {
+    row = page + (size_t)r*bpr;
+
+    /* left of x0, including the byte that contains it */
+    lim = x0/8 < nb ? x0/8 : nb-1;
+    for (i=0; i+8<=lim; i+=8) {
+      memcpy(&w, row+i, 8);
+      if (w) {
+	break;
+      }
+    }
+    for (; i<=lim; i++) {
+      b = row_byte(row, i, nb, lastmask);
+      if (b) {
+	x = 8*i + x1list[b];
+	x0 = x < x0 ? x : x0;
+	break;
+      }
+    }
+
+    /* right of x1, including the byte that contains its last pixel */
+    lim = x1 > 0 ? (x1-1)/8 : 0;
+    for (i=nb-1; i>=lim; i--) {
+      if (i-7 > lim && i < nb-1) {
+	memcpy(&w, row+i-7, 8);
+	if (w == 0) {
+	  i -= 7;
+	  continue;
+	}
+      }
+      b = row_byte(row, i, nb, lastmask);
+      if (b) {
+	x = 8*i + x2list[b];
+	x1 = x > x1 ? x : x1;
+	break;
+      }
+    }
+  }
+
+  rowcount[h-1-top]++;
+  rowcount[h-1-bot]++;
+  colcount[x0]++;
+  colcount[x1-1]++;
+  if (st) {
+    st->x0 = x0;
+    st->y0 = h-1-bot;
+    st->x1 = x1;
+    st->y1 = h-top;
+  }
+  return 0;
+}
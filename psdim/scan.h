@@ -0,0 +1,29 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+/* the extent and amount of ink of a single page, in pixels */
+struct pagestat_s {
+  int page;             /* page number, counting from 1 */
+  int x0, y0, x1, y1;   /* bounding box of the ink; x0 >= x1 if blank */
+  long long ink;        /* number of ink pixels, or -1 if unknown */
+};
+typedef struct pagestat_s pagestat_t;
+
+int p4_histogram(unsigned char *page, int bpr, int h, int cw, int ch,
+		 long long *rowcount, long long *colcount, pagestat_t *st);
+int p4_extent(unsigned char *page, int bpr, int h, int cw, int ch,
+	      long long *rowcount, long long *colcount, pagestat_t *st);
+int rgb_histogram(unsigned char *page, int bpr, int w, int h, int bpp, int cw, int ch,
+		  long long *rowcount, long long *colcount, pagestat_t *st);
+int gray_histogram(unsigned char *page, int bpr, int w, int h, int threshold, int cw, int ch,
+		   long long *rowcount, long long *colcount, pagestat_t *st);
+int gray_coverage(unsigned char *page, int bpr, int w, int h, int cw, int ch,
+		  long long *rowcount, long long *colcount,
+		  unsigned char *rowmax, unsigned char *colmax, pagestat_t *st);
+
+#endif /* SCAN_H */
@@ -0,0 +1,516 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* the server mode. psdim listens on a Unix domain socket, and keeps a
+   pool of ghostscript processes that are started in advance, so that
+   a request does not have to wait for ghostscript to start up. A
+   request consists of two lines: the name of a document, and the
+   options for measuring it, as on the command line. It is handled by
+   a child process, which parses the options and renders the document
+   in an idle ghostscript of the pool. The document is run inside
+   save and restore, so that it cannot affect the next one. The reply
+   is the output of psdim with these options, i.e., the page format
+   or an error message, after which the connection is closed.
+
+   A ghostscript is restarted after a given number of requests, or as
+   soon as a document caused an error. Documents that the pool cannot
+   render (PDF files, and pixmaps on a bitmap pool or vice versa), as
+   well as engines other than the default one, are measured by the
+   usual means. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "main.h"
+#include "psdim.h"
+#include "serve.h"
+
+#define RECYCLE  100    /* exit code of a request that broke its ghostscript */
+#define REQUEST  4096   /* longest line of a request */
+#define ARGS     64     /* most options in a request */
+#define TIMEOUT  30     /* seconds to wait for a request */
+
+/* the ghostscript of the request handled by this process, or NULL */
+gsproc_t *serve_gs = NULL;
+
+static gsproc_t pool[SERVE_MAX];
+static volatile sig_atomic_t stop = 0;
+
+static void serve_stop(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+/* ---------------------------------------------------------------------- */
+/* the pool */
+
+/* start the ghostscript of gs, rendering as given by color (one of
+   COLOR_*). Return 0 on success, or -1 with merrno set. */
+static int gs_start(gsproc_t *gs, int color) {
+  char *argv[GS_ARGS];
+  int fd[2];
+
+  if (pipe(fd) == -1) {
+    merrno = ME_IO;
+    return -1;
+  }
+  fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+  gs_args(argv, color);
+  gs->out = gs_open(argv, fd[0], 1, &gs->pid);
+  close(fd[0]);
+  if (!gs->out) {
+    close(fd[1]);
+    gs->pid = 0;
+    return -1;
+  }
+  fcntl(fileno(gs->out), F_SETFD, FD_CLOEXEC);
+  gs->in = fd[1];
+  gs->color = color;
+  gs->fast_images = info.fast_images;
+  gs->fast_text = info.fast_text;
+  gs->res = info.resolution;
+  gs->jobs = 0;
+  gs->child = 0;
+  gs->broken = 0;
+  return 0;
+}
+
+/* stop the ghostscript of gs, if any */
+static void gs_stop(gsproc_t *gs) {
+  if (gs->pid) {
+    kill(gs->pid, SIGTERM);
+    close(gs->in);
+    gs_close(gs->out, gs->pid);
+    gs->pid = 0;
+  }
+}
+
+/* take note that the process pid has terminated with the given
+   status. It is either a child handling a request, or a ghostscript
+   of the pool that died by itself. */
+static void serve_reaped(pid_t pid, int status) {
+  gsproc_t *gs;
+
+  for (gs = pool; gs < pool + info.serve_jobs; gs++) {
+    if (gs->child == pid) {
+      gs->child = 0;
+      gs->jobs++;
+      if (!WIFEXITED(status) || WEXITSTATUS(status) == RECYCLE
+	  || gs->jobs >= info.serve_recycle) {
+	gs->broken = 1;
+      }
+    } else if (gs->pid == pid) {
+      close(gs->in);
+      fclose(gs->out);
+      gs->pid = 0;
+    }
+  }
+}
+
+/* return an idle member of the pool, or NULL if all are busy */
+static gsproc_t *serve_idle(void) {
+  gsproc_t *gs;
+
+  for (gs = pool; gs < pool + info.serve_jobs; gs++) {
+    if (!gs->child) {
+      return gs;
+    }
+  }
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------- */
+/* handling a request, in a child process */
+
+/* read a line of at most size-1 characters from fd into buf, without
+   the newline. Return 0 on success, or -1 on error or if the line is
+   too long. */
+static int read_line(int fd, char *buf, int size) {
+  int i;
+  ssize_t r;
+
+  for (i=0; i<size; i++) {
+    r = read(fd, buf+i, 1);
+    if (r == -1 && errno == EINTR) {
+      i--;
+      continue;
+    }
+    if (r == -1) {
+      return -1;
+    }
+    if (r == 0 || buf[i] == '\n') {
+      buf[i] = 0;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* handle the request on the connection fd with the ghostscript gs,
+   and exit */
+static void serve_request(int fd, gsproc_t *gs) {
+  char path[REQUEST], options[REQUEST];
+  char *av[ARGS+3];
+  struct timeval tv;
+  int ac;
+  char *p;
+
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGHUP, SIG_DFL);
+
+  tv.tv_sec = TIMEOUT;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  if (read_line(fd, path, REQUEST) || read_line(fd, options, REQUEST)) {
+    exit(1);
+  }
+
+  /* the reply is whatever psdim writes */
+  dup2(fd, 1);
+  dup2(fd, 2);
+  close(fd);
+
+  if (!*path) {
+    fprintf(stderr, ""PSDIM": no document given\n");
+    exit(1);
+  }
+  ac = 0;
+  av[ac++] = PSDIM;
+  for (p = strtok(options, " \t\r"); p; p = strtok(NULL, " \t\r")) {
+    if (ac > ARGS) {
+      fprintf(stderr, ""PSDIM": too many options\n");
+      exit(1);
+    }
+    av[ac++] = p;
+  }
+  av[ac++] = path;
+  av[ac] = NULL;
+
+  optind = 0;
+  dopts(ac, av);
+  /* the server's files are not the client's business */
+  if (info.serve || info.batch || info.raster || info.save_hist || info.load_hist
+      || info.perpage || info.cache) {
+    fprintf(stderr, ""PSDIM": only layout and measuring options can be requested\n");
+    exit(1);
+  }
+  info.quiet = 1;
+  serve_gs = gs;
+  psdim_run();
+  fflush(stdout);
+  exit(gs->broken ? RECYCLE : 0);
+}
+
+/* ---------------------------------------------------------------------- */
+/* rendering with a ghostscript of the pool */
+
+/* can infile be rendered with this process's ghostscript? */
+int serve_warm(char *infile, int color) {
+  int fd, pdf;
+
+  if (!serve_gs || !serve_gs->pid || serve_gs->broken || !infile
+      || color != serve_gs->color
+      || info.fast_images != serve_gs->fast_images
+      || info.fast_text != serve_gs->fast_text
+      || info.resolution != serve_gs->res) {
+    return 0;
+  }
+  fd = open(infile, O_RDONLY);
+  if (fd == -1) {
+    return 0;
+  }
+  pdf = is_pdf(fd);
+  close(fd);
+  return !pdf;
+}
+
+/* make up a string that marks the end of a document, and is unlikely
+   to occur in it */
+static void serve_mark(char *mark) {
+  unsigned char r[8];
+  int fd, i;
+
+  fd = open("/dev/urandom", O_RDONLY);
+  if (fd == -1 || read(fd, r, 8) != 8) {
+    srand(time(NULL) ^ getpid());
+    for (i=0; i<8; i++) {
+      r[i] = rand();
+    }
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  strcpy(mark, "%%EOD-"PSDIM"-");
+  for (i=0; i<8; i++) {
+    sprintf(mark + strlen(mark), "%02x", r[i]);
+  }
+}
+
+/* write the job for the document fd to the ghostscript gs: the
+   document is read from ghostscript's standard input up to mark, and
+   run inside save and restore, stopping at the first error. The
+   media is set to the canvas, and the page size prelude (see
+   serve_prelude) reports the size that each page asks for, and keeps
+   the media fixed. The operand and dictionary stacks are cleared
+   before the restore. Then
+   a line "%%psdim-done <e>" is written, where e is 1 after an
+   error, and 0 otherwise. Return 0 on success, or -1 on error. */
+static int serve_feed(int fd, gsproc_t *gs, char *mark) {
+  char buf[BUFSIZ];
+  ssize_t r;
+  int len;
+
+  len = snprintf(buf, BUFSIZ,
+		 "save /psdim_save exch def\n"
+		 "<< /PageSize [%d %d] >> setpagedevice\n"
+		 "%s\n"
+		 "{ /psdim_in currentfile 0 (%s) /SubFileDecode filter def"
+		 " psdim_in cvx stopped { 1 } { 0 } ifelse psdim_in flushfile"
+		 " count 1 sub { exch pop } repeat cleardictstack psdim_save restore"
+		 " (%%%%psdim-done ) print = flush } bind exec\n",
+		 info.canvas_w, info.canvas_h, serve_prelude, mark);
+  if (write(gs->in, buf, len) != len) {
+    return -1;
+  }
+  while ((r = read(fd, buf, BUFSIZ)) != 0) {
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    if (r == -1 || write(gs->in, buf, r) != r) {
+      return -1;
+    }
+  }
+  len = snprintf(buf, BUFSIZ, "\n%s\n", mark);
+  if (write(gs->in, buf, len) != len) {
+    return -1;
+  }
+  return 0;
+}
+
+/* render the document infile with this process's ghostscript, and
+   add its pages to hist. Output of the document other than pages and
+   their page size reports is passed on to stderr. If the document caused an error, or
+   ghostscript did not respond as expected, it is marked to be
+   restarted. Return the number of pages rendered, or -1 with merrno
+   set. */
+int serve_render(char *infile, hist_t *hist) {
+  static pnmpage_t pg;  /* keeps its buffer from call to call */
+  gsproc_t *gs = serve_gs;
+  char mark[40], line[256];
+  struct stat st;
+  int fd, c, e, r, pages;
+  pid_t feeder;
+
+  fd = open(infile, O_RDONLY);
+  if (fd == -1) {
+    merrno = ME_IO;
+    return -1;
+  }
+  fstat(fd, &st);
+  if (S_ISDIR(st.st_mode)) {
+    close(fd);
+    errno = EISDIR;
+    merrno = ME_IO;
+    return -1;
+  }
+
+  /* a separate process feeds the document to ghostscript */
+  serve_mark(mark);
+  feeder = fork();
+  if (feeder == -1) {
+    close(fd);
+    merrno = ME_IO;
+    return -1;
+  }
+  if (feeder == 0) {
+    _exit(serve_feed(fd, gs, mark) ? 1 : 0);
+  }
+  close(fd);
+
+  pages = 0;
+  side_open(-1);
+  while (1) {
+    c = getc(gs->out);
+    if (c == 'P') {
+      ungetc(c, gs->out);
+      r = pnm_read(gs->out, &pg);
+      if (r <= 0) {
+	merrno = r == 0 ? ME_EOF : merrno;
+	break;
+      }
+      pg.sized = side_pagesize(&pg.height) == 0;
+      if (hist_page(hist, pages, &pg)) {
+	r = -1;
+	break;
+      }
+      pages++;
+    } else if (c != EOF) {
+      ungetc(c, gs->out);
+      if (!fgets(line, sizeof(line), gs->out)) {
+	merrno = ME_EOF;
+	r = -1;
+	break;
+      }
+      if (sscanf(line, "%%%%psdim-done %d", &e) == 1) {
+	gs->broken = e != 0;
+	r = pages;
+	break;
+      }
+      if (side_write(line, strlen(line))) {
+	r = -1;
+	break;
+      }
+    } else {
+      merrno = ME_EOF;
+      r = -1;
+      break;
+    }
+  }
+  side_close();
+  if (r < 0) {
+    gs->broken = 1;
+    kill(feeder, SIGTERM);
+  }
+  waitpid(feeder, NULL, 0);
+  return r;
+}
+
+/* ---------------------------------------------------------------------- */
+/* the server */
+
+/* answer requests on the Unix domain socket path until terminated by
+   a signal. Return 0 on success, or an merrno code on error. */
+int psdim_serve(char *path) {
+  struct sockaddr_un addr;
+  struct sigaction sa;
+  struct stat st;
+  gsproc_t *gs;
+  int sock, fd, status, r;
+  mode_t mask;
+  pid_t pid;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, ""PSDIM": %s: %s\n", path, strerror(ENAMETOOLONG));
+    return ME_IO;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1) {
+    fprintf(stderr, ""PSDIM": %s: %s\n", path, strerror(errno));
+    return ME_IO;
+  }
+
+  /* a socket left over from an earlier server is replaced, but not
+     one that a server is still listening on */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      fprintf(stderr, ""PSDIM": %s: another server is running\n", path);
+      close(sock);
+      return ME_IO;
+    }
+    close(sock);
+    unlink(path);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  }
+
+  /* only the server's user may connect */
+  mask = umask(077);
+  r = sock == -1 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1;
+  umask(mask);
+  if (r || listen(sock, 16) == -1) {
+    fprintf(stderr, ""PSDIM": %s: %s\n", path, strerror(errno));
+    return ME_IO;
+  }
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = serve_stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  /* the pool renders on the default canvas, until a request says
+     otherwise */
+  if (info.canvas_w == 0) {
+    info.canvas_w = info.canvas_h = CANVAS;
+  }
+  memset(pool, 0, sizeof(pool));
+
+  while (!stop) {
+    /* collect the finished requests, waiting for one if all of the
+       pool is busy */
+    while ((pid = waitpid(-1, &status, serve_idle() ? WNOHANG : 0)) > 0) {
+      serve_reaped(pid, status);
+    }
+    if (stop) {
+      break;
+    }
+
+    /* restart ghostscripts that are due, before they are needed */
+    for (gs = pool; gs < pool + info.serve_jobs; gs++) {
+      if (!gs->child && (!gs->pid || gs->broken)) {
+	gs_stop(gs);
+	if (gs_start(gs, info.color)) {
+	  fprintf(stderr, ""PSDIM": %s\n", mstrerror[merrno]);
+	}
+      }
+    }
+
+    fd = accept(sock, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+	continue;
+      }
+      fprintf(stderr, ""PSDIM": %s: %s\n", path, strerror(errno));
+      break;
+    }
+    gs = serve_idle();
+    pid = fork();
+    if (pid == 0) {
+      close(sock);
+      serve_request(fd, gs);
+    }
+    close(fd);
+    if (pid == -1) {
+      fprintf(stderr, ""PSDIM": %s\n", strerror(errno));
+      continue;
+    }
+    gs->child = pid;
+  }
+
+  /* let the requests in progress finish */
+  close(sock);
+  unlink(path);
+  for (gs = pool; gs < pool + info.serve_jobs; gs++) {
+    while (gs->child && (pid = waitpid(-1, &status, 0)) > 0) {
+      serve_reaped(pid, status);
+    }
+    gs_stop(gs);
+  }
+  return 0;
+}
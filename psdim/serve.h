@@ -0,0 +1,38 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "psdim.h"
+
+#define SERVE_MAX 64    /* largest number of concurrent requests */
+
+/* a ghostscript process of the server's pool, which runs one
+   document after another from its standard input */
+struct gsproc_s {
+  pid_t pid;            /* the ghostscript process, or 0 if none */
+  int in;               /* its standard input */
+  FILE *out;            /* its standard output */
+  int color;            /* how it renders, one of COLOR_* */
+  int fast_images;      /* does it elide images? */
+  int fast_text;        /* and text? */
+  int res;              /* its resolution, in pixels per inch */
+  int jobs;             /* requests handled so far */
+  pid_t child;          /* the process handling a request, or 0 if idle */
+  int broken;           /* must it be restarted? */
+};
+typedef struct gsproc_s gsproc_t;
+
+extern gsproc_t *serve_gs;
+
+int serve_warm(char *infile, int color);
+int serve_render(char *infile, hist_t *hist);
+int psdim_serve(char *socket);
+
+#endif /* SERVE_H */
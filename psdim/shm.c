@@ -0,0 +1,370 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+/* the shared-memory raster transport. Instead of writing all pages
+   to a pipe, ghostscript writes each page to a file of its own in a
+   private directory, preferably in /dev/shm, which lives in memory.
+   Each page is mapped into memory as soon as it is complete, counted
+   in place, and removed. The pixels are never copied through a pipe
+   or a stdio buffer. A page is known to be complete when ghostscript
+   closes its file (which inotify reports, on Linux), when the next
+   page's file appears, or when ghostscript exits. Ghostscript is
+   stopped while more than AHEAD bytes of complete pages are waiting
+   to be counted, so that it cannot fill the directory when it renders
+   faster than the pages are counted. */
+
+#ifdef HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+ #include <sys/inotify.h>
+#endif
+
+#include "main.h"
+#include "psdim.h"
+#include "shm.h"
+
+#define SHMDIR "/dev/shm"
+#define POLL   10   /* milliseconds between checks without inotify */
+#define NAMELEN (PATH_MAX+32)  /* room for the name of a page */
+#define AHEAD  (64*1024*1024)  /* bytes of pages rendered ahead */
+
+/* make a private directory for the pages. Return 0 on success, or
+   -1 with merrno set. */
+static int shm_mkdir(char *dir) {
+  struct stat st;
+  char *tmp;
+
+  if (stat(SHMDIR, &st) == 0 && S_ISDIR(st.st_mode) && access(SHMDIR, W_OK) == 0) {
+    tmp = SHMDIR;
+  } else {
+    tmp = getenv("TMPDIR");
+    if (!tmp || !*tmp) {
+      tmp = "/tmp";
+    }
+  }
+  if (strlen(tmp) > PATH_MAX-32) {
+    errno = ENAMETOOLONG;
+    merrno = ME_IO;
+    return -1;
+  }
+  sprintf(dir, "%s/"PSDIM"-XXXXXX", tmp);
+  if (!mkdtemp(dir)) {
+    merrno = ME_IO;
+    return -1;
+  }
+  return 0;
+}
+
+/* read a header number from p (with at most end-p bytes left), in
+   the manner of readnum. Return -1 on error. */
+static int memnum(unsigned char **p, unsigned char *end) {
+  int acc;
+
+  while (*p < end && !(**p >= '0' && **p <= '9')) {
+    if (**p == '#') {
+      while (*p < end && **p != '\n') {
+	(*p)++;
+      }
+    } else if (**p != ' ' && **p != '\t' && **p != '\r' && **p != '\n') {
+      return -1;
+    } else {
+      (*p)++;
+    }
+  }
+  if (*p == end) {
+    return -1;
+  }
+  acc = 0;
+  while (*p < end && **p >= '0' && **p <= '9') {
+    acc = 10*acc + (**p - '0');
+    (*p)++;
+  }
+  /* a single whitespace character ends the number */
+  if (*p == end) {
+    return -1;
+  }
+  (*p)++;
+  return acc;
+}
+
+/* the name of the file of page k */
+static void page_path(char *path, char *dir, int k) {
+  snprintf(path, NAMELEN, "%s/p%d.pnm", dir, k);
+}
+
+static int page_exists(char *dir, int k) {
+  char path[NAMELEN];
+
+  page_path(path, dir, k);
+  return access(path, F_OK) == 0;
+}
+
+/* the number of bytes in the files of the pages after page k */
+static off_t pages_ahead(char *dir, int k) {
+  char path[NAMELEN];
+  struct stat st;
+  off_t size = 0;
+
+  for (k++; ; k++) {
+    page_path(path, dir, k);
+    if (stat(path, &st) == -1) {
+      return size;
+    }
+    size += st.st_size;
+  }
+}
+
+/* count the file of page k, which is page number page of the
+   document, in place, and remove it. Return 0 on success, or -1 with
+   merrno set. */
+static int shm_page(char *dir, int k, hist_t *hist, int page) {
+  char path[NAMELEN];
+  struct stat st;
+  unsigned char *map, *p, *end;
+  pnmpage_t pg;
+  int fd, maxval, r;
+
+  page_path(path, dir, k);
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    merrno = ME_IO;
+    return -1;
+  }
+  unlink(path);
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    merrno = ME_IO;
+    return -1;
+  }
+  if (st.st_size < 3) {
+    close(fd);
+    merrno = ME_EOF;
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    merrno = ME_IO;
+    return -1;
+  }
+
+  r = -1;
+  merrno = ME_POSTSCRIPT;
+  p = map + 2;
+  end = map + st.st_size;
+  if (map[0] != 'P' || (map[1] != '4' && map[1] != '5' && map[1] != '6')) {
+    goto done;
+  }
+  pg.w = memnum(&p, end);
+  pg.h = memnum(&p, end);
+  if (pg.w < 0 || pg.h < 0) {
+    goto done;
+  }
+  if (map[1] == '4') {
+    pg.bpp = 0;
+    pg.bpr = 1+(pg.w-1)/8;
+  } else {
+    maxval = memnum(&p, end);
+    if (maxval<1 || maxval>=65536) {
+      goto done;
+    }
+    pg.bpp = (maxval >= 256) ? 2 : 1;
+    if (map[1] == '6') {
+      pg.bpp *= 3;
+    }
+    pg.bpr = pg.w * pg.bpp;
+  }
+  pg.size = (size_t)pg.bpr * pg.h;
+  pg.data = p;
+  pg.datalen = end - p;
+  /* the report of the page was written before the page */
+  pg.sized = side_pagesize(&pg.height) == 0;
+  if (pg.size > pg.datalen) {
+    merrno = ME_EOF;
+    goto done;
+  }
+  r = hist_page(hist, page, &pg);
+
+ done:
+  munmap(map, st.st_size);
+  return r;
+}
+
+/* remove the directory and any pages left in it */
+static void shm_rmdir(char *dir, int from) {
+  char path[NAMELEN];
+  int k;
+
+  for (k=from; page_exists(dir, k); k++) {
+    page_path(path, dir, k);
+    unlink(path);
+  }
+  rmdir(dir);
+}
+
+/* run ghostscript with the arguments argv from gs_args, with its
+   standard input connected to fdin (or inherited, if fdin is -1),
+   and add the pages it renders to hist, like read_pnm, but using the
+   shared-memory transport. Like gs_render, fdin is closed once
+   ghostscript has been started. Ghostscript's standard output is passed
+   on to stderr. Return the number of pages rendered, or -1 with
+   merrno set. */
+
+int shm_render(char *argv[], int fdin, hist_t *hist, int first) {
+  char dir[PATH_MAX];
+  char output[NAMELEN];
+  char buf[BUFSIZ];
+  char *args[GS_ARGS];
+  struct pollfd fds[3];
+  int i, k, n, r, eof, closed, nfds, notify, stopped, side = -1;
+  ssize_t len;
+  pid_t pid;
+  FILE *f;
+#ifdef __linux__
+  char events[4096];
+  struct inotify_event *ev;
+  char *q;
+#endif
+
+  if (shm_mkdir(dir)) {
+    return -1;
+  }
+  sprintf(output, "-sOutputFile=%s/p%%d.pnm", dir);
+  for (i=0; argv[i]; i++) {
+    args[i] = strcmp(argv[i], "-sOutputFile=-") == 0 ? output : argv[i];
+  }
+  args[i] = NULL;
+
+  notify = 0;
+#ifdef __linux__
+  fds[1].fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fds[1].fd != -1) {
+    if (inotify_add_watch(fds[1].fd, dir, IN_CLOSE_WRITE) == -1) {
+      close(fds[1].fd);
+    } else {
+      fds[1].events = POLLIN;
+      notify = 1;
+    }
+  }
+#endif
+
+  f = gs_spawn(args, fdin, 1, has_pagesize(args) ? &side : NULL, &pid);
+  if (fdin != -1) {
+    close(fdin);
+  }
+  if (!f) {
+    if (notify) {
+      close(fds[1].fd);
+    }
+    rmdir(dir);
+    return -1;
+  }
+  fds[0].fd = fileno(f);
+  fds[0].events = POLLIN;
+  nfds = 1 + notify;
+  /* the page size reports arrive on ghostscript's standard error */
+  if (side != -1) {
+    side_open(side);
+    fds[nfds].fd = side;
+    fds[nfds].events = POLLIN;
+    nfds++;
+  }
+
+  k = 1;        /* the next page to count */
+  closed = 0;   /* pages known to be closed by ghostscript */
+  eof = 0;      /* has ghostscript finished? */
+  stopped = 0;  /* has ghostscript been stopped? */
+  r = 0;
+  while (1) {
+    /* count the pages that are complete, keeping ghostscript from
+       running too far ahead */
+    while (k <= closed || page_exists(dir, k+1)
+	   || (eof && page_exists(dir, k))) {
+      if (!eof && !stopped && pages_ahead(dir, k) > AHEAD) {
+	kill(pid, SIGSTOP);
+	stopped = 1;
+      }
+      if (shm_page(dir, k, hist, first+r)) {
+	r = -1;
+	goto done;
+      }
+      k++;
+      r++;
+    }
+    if (stopped) {
+      kill(pid, SIGCONT);
+      stopped = 0;
+    }
+    if (eof) {
+      break;
+    }
+
+    /* wait for ghostscript */
+    n = poll(fds, nfds, notify ? -1 : POLL);
+    if (n == -1 && errno != EINTR) {
+      merrno = ME_IO;
+      r = -1;
+      goto done;
+    }
+    if (n <= 0) {
+      continue;
+    }
+    if (fds[0].revents) {
+      len = read(fds[0].fd, buf, sizeof(buf));
+      if (len > 0) {
+	fwrite(buf, 1, len, stderr);
+      } else if (len == 0 || errno != EINTR) {
+	eof = 1;
+      }
+    }
+    if (side != -1 && fds[nfds-1].revents && side_drain() != 0) {
+      nfds--;  /* closed, or unreadable */
+      side = -1;
+    }
+#ifdef __linux__
+    if (notify && fds[1].revents) {
+      while ((len = read(fds[1].fd, events, sizeof(events))) > 0) {
+	for (q = events; q < events + len; q += sizeof(struct inotify_event) + ev->len) {
+	  ev = (struct inotify_event *)q;
+	  if (ev->len && sscanf(ev->name, "p%d.pnm", &n) == 1 && n > closed) {
+	    closed = n;
+	  }
+	}
+      }
+    }
+#endif
+  }
+
+ done:
+  if (r < 0) {
+    kill(pid, SIGTERM);
+  }
+  if (stopped) {
+    kill(pid, SIGCONT);
+  }
+  if (gs_close(f, pid)) {
+    r = -1;
+  }
+  side_close();
+  if (notify) {
+    close(fds[1].fd);
+  }
+  shm_rmdir(dir, k);
+  return r;
+}
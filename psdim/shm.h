@@ -0,0 +1,13 @@
+/* Copyright (C) 2001-2012 Peter Selinger.
+   This file is part of the upprint package. It is free software and
+   is distributed under the terms of the GNU general public license.
+   See the file COPYING for details. */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include "psdim.h"
+
+int shm_render(char *argv[], int fdin, hist_t *hist, int first);
+
+#endif /* SHM_H */